@@ -41,6 +41,9 @@ public:
     virtual ~ActivationFct(){}
     virtual double activate(double val) const = 0;
     virtual double prime(double val) const = 0;
+    //in-place versions over a whole block of values (one virtual call per block)
+    virtual void activate(Eigen::Ref<Matrix> values) const = 0;
+    virtual void prime(Eigen::Ref<Matrix> values) const = 0;
     virtual void learn(double gradient, double learningRate) = 0;
     virtual void setCoefs(Vector const& coefs) = 0;
     virtual rowVector getCoefs() const = 0;
@@ -74,6 +77,8 @@ public:
     Linear(Vector const& coefs = Vector());
     double activate(double val) const;
     double prime(double val) const;
+    void activate(Eigen::Ref<Matrix> values) const;
+    void prime(Eigen::Ref<Matrix> values) const;
     void learn(double gradient, double learningRate);
     void setCoefs(Vector const& coefs);
     rowVector getCoefs() const;
@@ -90,6 +95,8 @@ public:
     Sigmoid(Vector const& coefs = Vector());
     double activate(double val) const;
     double prime(double val) const;
+    void activate(Eigen::Ref<Matrix> values) const;
+    void prime(Eigen::Ref<Matrix> values) const;
     void learn(double gradient, double learningRate);
     void setCoefs(Vector const& coefs);
     rowVector getCoefs() const;
@@ -106,6 +113,8 @@ public:
     Tanh(Vector const& coefs = Vector());
     double activate(double val) const;
     double prime(double val) const;
+    void activate(Eigen::Ref<Matrix> values) const;
+    void prime(Eigen::Ref<Matrix> values) const;
     void learn(double gradient, double learningRate);
     void setCoefs(Vector const& coefs);
     rowVector getCoefs() const;
@@ -122,6 +131,8 @@ public:
     Softplus(Vector const& coefs = Vector());
     double activate(double val) const;
     double prime(double val) const;
+    void activate(Eigen::Ref<Matrix> values) const;
+    void prime(Eigen::Ref<Matrix> values) const;
     void learn(double gradient, double learningRate);
     void setCoefs(Vector const& coefs);
     rowVector getCoefs() const;
@@ -138,6 +149,8 @@ public:
     Relu(Vector const& coefs = (Vector(1) << 0.01).finished());
     double activate(double val) const;
     double prime(double val) const;
+    void activate(Eigen::Ref<Matrix> values) const;
+    void prime(Eigen::Ref<Matrix> values) const;
     void learn(double gradient, double learningRate);
     void setCoefs(Vector const& coefs);
     rowVector getCoefs() const;
@@ -168,6 +181,8 @@ public:
     Elu(Vector const& coefs = (Vector(1) << 0.01).finished());
     double activate(double val) const;
     double prime(double val) const;
+    void activate(Eigen::Ref<Matrix> values) const;
+    void prime(Eigen::Ref<Matrix> values) const;
     void learn(double gradient, double learningRate);
     void setCoefs(Vector const& coefs);
     rowVector getCoefs() const;
@@ -198,6 +213,8 @@ public:
     Srelu(Vector const& coefs = (Vector(5) << 1.0, 0.1, 1.0, -1.0, 1.0).finished());
     double activate(double val) const;
     double prime(double val) const;
+    void activate(Eigen::Ref<Matrix> values) const;
+    void prime(Eigen::Ref<Matrix> values) const;
     void learn(double gradient, double learningRate);
     void setCoefs(Vector const& coefs);
     rowVector getCoefs() const;
@@ -227,6 +244,8 @@ public:
     //Gauss(); // should take mean and deviation, and make a parametric version
     double activate(double val) const;
     double prime(double val) const;
+    void activate(Eigen::Ref<Matrix> values) const;
+    void prime(Eigen::Ref<Matrix> values) const;
     void learn(double gradient, double learningRate);
     void setCoefs(Vector const& coefs);
     rowVector getCoefs() const;
@@ -247,6 +266,8 @@ public:
     Psoftexp(Vector const& coefs = (Vector(1) << 0.01).finished());
     double activate(double val) const;
     double prime(double val) const;
+    void activate(Eigen::Ref<Matrix> values) const;
+    void prime(Eigen::Ref<Matrix> values) const;
     void learn(double gradient, double learningRate);
     void setCoefs(Vector const& coefs);
     rowVector getCoefs() const;
@@ -263,6 +284,8 @@ protected:
 
 Vector singleSoftmax(Vector input);
 Matrix softmax(Matrix inputs);
+//each line, without allocation
+void softmaxInPlace(Eigen::Ref<Matrix> inputs);
 
 
 static std::map<size_t, std::function<std::shared_ptr<ActivationFct>()>> activationMap = {
@@ -0,0 +1,83 @@
+// InferenceEngine.hh
+
+#ifndef OMNILEARN_INFERENCEENGINE_HH_
+#define OMNILEARN_INFERENCEENGINE_HH_
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <future>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "Network.hh"
+
+
+
+namespace omnilearn
+{
+
+
+
+struct InferenceStats
+{
+    size_t requests; //requests answered since the creation of the engine
+    size_t batches; //batches processed since the creation of the engine
+    double p50; //latency percentiles of the recent requests, in microseconds, from submission to answer
+    double p99;
+};
+
+
+
+//answers single-feature requests coming from any thread. Requests are gathered in micro-batches that
+//go through the batched forward pass of the network, on a single dispatching thread.
+//A batch is processed when it reaches maxBatch features, or when its oldest request has waited budget
+class InferenceEngine
+{
+public:
+    //the network must outlive the engine, and must not learn meanwhile
+    InferenceEngine(Network const& network, size_t maxBatch = 64, std::chrono::microseconds budget = std::chrono::microseconds(200));
+    InferenceEngine(InferenceEngine const&) = delete;
+    InferenceEngine& operator=(InferenceEngine const&) = delete;
+    //the pending requests are answered before the engine stops
+    ~InferenceEngine();
+    //outputs of one feature (raw inputs, as given to Network::process), throws if it has not the right size
+    std::future<Vector> submit(Vector input);
+    InferenceStats stats() const;
+
+protected:
+    struct Request
+    {
+        Vector input;
+        std::promise<Vector> result;
+        std::chrono::steady_clock::time_point submitted;
+    };
+
+    void run();
+    void processBatch(std::vector<Request>& batch);
+
+protected:
+    Network const& _network;
+    size_t _inputSize;
+    size_t _maxBatch;
+    std::chrono::microseconds _budget;
+    std::deque<Request> _queue;
+    bool _stop;
+    std::mutex _mutex;
+    std::condition_variable _condition;
+
+    //latencies of the last requests (ring buffer), in microseconds
+    std::vector<double> _latencies;
+    size_t _requests;
+    size_t _batches;
+    mutable std::mutex _statsMutex;
+
+    std::thread _thread;
+};
+
+
+
+} // namespace omnilearn
+
+#endif // OMNILEARN_INFERENCEENGINE_HH_
@@ -0,0 +1,63 @@
+// InferenceSession.hh
+
+#ifndef OMNILEARN_INFERENCESESSION_HH_
+#define OMNILEARN_INFERENCESESSION_HH_
+
+#include "Network.hh"
+
+
+
+namespace omnilearn
+{
+
+
+
+//scores features of caller-owned memory into caller-owned memory, on the calling thread.
+//All the buffers are allocated by the constructor, processing doesn't allocate anything.
+//The preprocessing steps left in the network are applied as one affine map (see Network::foldPreprocessing).
+//A session is used by one thread at a time, several sessions can share a network. A copy has its own buffers
+class InferenceSession
+{
+public:
+    //lines are features, each line starts outerStride values after the previous one
+    using ConstView = Eigen::Map<Matrix const, 0, Eigen::OuterStride<>>;
+    using View = Eigen::Map<Matrix, 0, Eigen::OuterStride<>>;
+
+    //the network must outlive the session and must not change meanwhile (no distance aggregation).
+    //larger batches are processed maxBatch features at a time
+    InferenceSession(Network const& network, size_t maxBatch);
+    void process(ConstView const& inputs, View outputs);
+    //rows features of inputSize() values, stride values apart, give rows lines of outputSize() values, outputStride values apart
+    void process(double const* inputs, size_t rows, size_t stride, double* outputs, size_t outputStride);
+    size_t inputSize() const;
+    size_t outputSize() const;
+    //features whose buffers fit in the L2 cache, the batch size giving the best locality
+    static size_t blockRows(Network const& network);
+
+protected:
+    void processBlock(ConstView const& inputs, View outputs);
+
+protected:
+    Network const& _network;
+    size_t _maxBatch;
+    size_t _inputSize;
+    size_t _outputSize;
+
+    //preprocessing maps, transposed (empty if there is nothing to apply).
+    //centering, normalization and standardization only scale each input: the map is then kept as its diagonal
+    Matrix _inputMap;
+    rowVector _inputScale;
+    rowVector _inputOffset;
+    Matrix _outputMap;
+    rowVector _outputOffset;
+
+    Matrix _inputs; //preprocessed inputs
+    Matrix _buffers[2]; //activations of the layers, used in turn
+    Matrix _workspace; //weight sets of maxout layers
+};
+
+
+
+} // namespace omnilearn
+
+#endif // OMNILEARN_INFERENCESESSION_HH_
@@ -3,12 +3,16 @@
 #ifndef OMNILEARN_LAYER_HH_
 #define OMNILEARN_LAYER_HH_
 
-#include "Neuron.hh"
+#include "Activation.hh"
+#include "Aggregation.hh"
+#include "LayerKernel.hh"
+#include "optimizer.hh"
 #include "ThreadPool.hh"
 
 #include <map>
 #include <memory>
 #include <functional>
+#include <random>
 
 
 
@@ -17,6 +21,10 @@ namespace omnilearn
 
 
 
+enum class Distrib {Uniform, Normal};
+
+
+
 struct LayerParam
 {
     LayerParam():
@@ -48,24 +56,109 @@ public:
     void init(size_t nbInputs, size_t nbOutputs, std::mt19937& generator);
     void init(size_t nbInputs);
     Matrix process(Matrix const& inputs, ThreadPool& t) const;
+    //sparse inputs are only accepted by dot and maxout aggregations
+    Matrix process(SparseMatrix const& inputs, ThreadPool& t) const;
+    //inference in caller-owned buffers, on the calling thread and without allocation (not for distance aggregation).
+    //workspace has at least one column per weight set if k > 1, it is not used otherwise
+    void process(Eigen::Ref<Matrix const> const& inputs, Eigen::Ref<Matrix> output, Eigen::Ref<Matrix> workspace) const;
     Vector processToLearn(Vector const& input, double dropout, double dropconnect, std::bernoulli_distribution& dropoutDist, std::bernoulli_distribution& dropconnectDist, std::mt19937& dropGen, ThreadPool& t);
+    //lines are features of the batch, columns are neurons
+    Matrix processToLearn(Matrix const& inputs, double dropout, double dropconnect, std::bernoulli_distribution& dropoutDist, std::bernoulli_distribution& dropconnectDist, std::mt19937& dropGen, ThreadPool& t);
+    //the gradients of a sparse batch only touch the weights of its non-zero inputs, they can't be backpropagated (first layer)
+    Matrix processToLearn(SparseMatrix const& inputs, double dropout, double dropconnect, std::bernoulli_distribution& dropoutDist, std::bernoulli_distribution& dropconnectDist, std::mt19937& dropGen, ThreadPool& t);
     void computeGradients(Vector const& inputGradient, ThreadPool& t);
+    //one line of gradients per feature of the batch, summed over the batch
+    void computeGradients(Matrix const& inputGradients, ThreadPool& t);
     void computeGradientsAccordingToInputs(Vector const& inputGradients, ThreadPool& t);
     void save();
     void loadSaved();
-    Vector getGradients(ThreadPool& t); //one gradient per input neuron
+    //data-parallel replicas: the parameters of layer (same shape) are read instead of the own ones, nothing is copied.
+    //null reads the own parameters again. The parameters are only read through the const accessors
+    void shareParameters(Layer const* layer);
+    //adds the gradients accumulated by replica, then resets them in replica
+    void mergeGradients(Layer& replica);
+    //hogwild: copies the parameters of layer and keeps them to compute the update
+    void pullParameters(Layer const& layer);
+    //hogwild: adds to layer the change of the parameters since pullParameters, without synchronization
+    void pushParameters(Layer& layer) const;
+    Vector getGradients(ThreadPool& t) const; //one gradient per input neuron
+    Matrix getBatchGradients(ThreadPool& t) const; //one gradient per input neuron, for each feature of the batch
     void updateWeights(double learningRate, double L1, double L2, Optimizer opti, double momentum, double window, double optimizerBias, ThreadPool& t);
     size_t size() const;
-    std::vector<std::pair<Matrix, Vector>> getWeights(ThreadPool& t) const;
+    //one line per weight set (neuron i owns lines i*k to i*k+k-1)
+    Eigen::Map<Matrix const> getWeights() const;
+    Eigen::Map<Vector const> getBias() const;
     void resize(size_t neurons);
     std::vector<rowVector> getCoefs() const;
     void setCoefs(size_t neuron, Matrix const& weights, Vector const& bias, Vector const& aggreg, Vector const& activ);
+    //aggregation and activation ids
+    std::pair<size_t, size_t> getFunctions() const;
+    //aggregation and activation coefficients
+    std::pair<rowVector, rowVector> getFunctionCoefs() const;
+    //weights then bias of all the weight sets, contiguous (as in the parameter arena)
+    Eigen::Map<Vector const> getParameters() const;
+    //same layout, parameters copied by the last save()
+    Eigen::Map<Vector const> getSavedParameters() const;
+    //the layer must have been initialized with the right number of inputs
+    void setParameters(Eigen::Ref<Vector const> const& parameters, Vector const& aggreg, Vector const& activ);
+    //all the tensors (parameters, optimizer moments, saved parameters) and the number of updates, for checkpoints
+    Eigen::Map<Vector const> getArena() const;
+    size_t getIteration() const;
+    void setArena(Eigen::Ref<Vector const> const& arena, size_t iteration);
+
+protected:
+    //tensors stored in the parameter arena, each one is [weights | bias]
+    //FirstMoment also holds the previous update (momentum) and the gradient accumulation (adagrad, rmsprop)
+    enum class Tensor {Parameters, Gradients, FirstMoment, SecondMoment, MaxSecondMoment, Saved, Count};
+
+    void allocate(size_t nbInputs);
+    size_t tensorSize() const;
+    Eigen::Map<Matrix> weightTensor(Tensor tensor);
+    Eigen::Map<Matrix const> weightTensor(Tensor tensor) const;
+    Eigen::Map<Vector> biasTensor(Tensor tensor);
+    Eigen::Map<Vector const> biasTensor(Tensor tensor) const;
+    //start of a tensor to read, the Parameters one can be shared
+    double const* tensorData(Tensor tensor) const;
+    //weights used by the current batch (dropconnect applied)
+    Eigen::Map<Matrix const> batchWeights() const;
+    //averages the gradients, applies the rule, the regularization and the max norm constraint in one sweep per weight set
+    template<typename Rule> void applyUpdate(Rule const& rule, double learningRate, double L1, double L2, ThreadPool& t);
+    //aggregation and activation of each feature (lines) for each neuron (columns)
+    //sets receives the weight set used by each neuron for each feature
+    Matrix forward(Matrix const& inputs, Eigen::Map<Matrix const> const& weights, std::vector<size_t>& sets, ThreadPool& t) const;
+    Matrix forward(SparseMatrix const& inputs, Eigen::Map<Matrix const> const& weights, std::vector<size_t>& sets, ThreadPool& t) const;
+    //dot and maxout aggregations followed by the activation, for dense or sparse inputs
+    template<typename Inputs> void dotForward(Inputs const& inputs, Eigen::Map<Matrix const> const& weights, Matrix& output, std::vector<size_t>& sets, ThreadPool& t) const;
+    //forward pass of a batch with dropconnect and dropout, the masks are kept for the gradients
+    template<typename Inputs> Matrix forwardToLearn(Inputs const& inputs, double dropout, double dropconnect, std::bernoulli_distribution& dropoutDist, std::bernoulli_distribution& dropconnectDist, std::mt19937& dropGen, ThreadPool& t);
+    //adds the gradients of a sparse batch to the Gradients tensor, only on the columns of its non-zero inputs
+    void accumulateSparseGradients(ThreadPool& t);
+    //calls func(begin, count) on chunks of [0, size), chunks are not smaller than grain
+    static void forEachBlock(eigen_size_t size, size_t grain, ThreadPool& t, std::function<void(eigen_size_t, eigen_size_t)> const& func);
 
 protected:
     LayerParam _param;
     size_t _inputSize;
-    std::vector<Neuron> _neurons;
     std::pair<size_t, size_t> _aggrAct;
+    std::shared_ptr<AggregationFunc> _aggregation;
+    std::shared_ptr<ActivationFct> _activation;
+    std::shared_ptr<Kernel const> _kernel; //specialized kernel for the aggregation/activation pair, null if none
+
+    //parameters of all neurons, stored contiguously (see Tensor)
+    Vector _arena;
+    Layer const* _sharedParameters; //layer whose parameters are read instead of the own ones, null if none
+    std::vector<size_t> _weightsetCount; //counts the number of gradients in each weight set
+    size_t _iteration; //number of weight updates, for the bias correction of the optimizers
+
+    //batch learning
+    Matrix _batchInputs;
+    SparseMatrix _batchSparseInputs; //used instead of _batchInputs if it has lines
+    Matrix _batchActivations; //activation results, before dropout
+    Matrix _batchDropout; //dropout mask, scaled by 1/(1-dropout), empty if no dropout
+    Matrix _batchWeights; //weights used for the batch, only if dropconnect is used
+    Matrix _batchDropconnect; //dropconnect mask, scaled by 1/(1-dropconnect), empty if no dropconnect
+    std::vector<size_t> _batchSets; //weight set used by each neuron (columns) for each feature (lines)
+    Matrix _batchDeltas; //gradient on the aggregation result, for each feature and each weight set
 };
 
 
@@ -74,4 +167,4 @@ protected:
 
 
 
-#endif //OMNILEARN_LAYER_HH_
\ No newline at end of file
+#endif //OMNILEARN_LAYER_HH_
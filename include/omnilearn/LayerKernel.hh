@@ -0,0 +1,165 @@
+// LayerKernel.hh
+
+#ifndef OMNILEARN_LAYERKERNEL_HH_
+#define OMNILEARN_LAYERKERNEL_HH_
+
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <map>
+#include <memory>
+
+#include "Activation.hh"
+#include "Aggregation.hh"
+
+
+
+namespace omnilearn
+{
+
+
+
+// interface
+class Kernel
+{
+public:
+    virtual ~Kernel(){}
+    //aggregation and activation of a block of features (lines), one column per neuron
+    virtual void process(Eigen::Ref<Matrix const> const& inputs, Eigen::Map<Matrix const> const& weights, Eigen::Map<Vector const> const& bias, rowVector const& coefs, Eigen::Ref<Matrix> output) const = 0;
+    //derivative of the activation, in place, taking activation results
+    virtual void prime(Eigen::Ref<Matrix> values, rowVector const& coefs) const = 0;
+};
+
+
+
+//compile-time aggregations and activations used by the kernels.
+//they must give the same results as their counterparts in Aggregation.cpp and Activation.cpp
+namespace kernel
+{
+
+
+
+struct Dot
+{
+    //the bias is added by the kernel, along with the activation
+    static void aggregate(Eigen::Ref<Matrix const> const& inputs, Eigen::Map<Matrix const> const& weights, Eigen::Ref<Matrix> output)
+    {
+        output.noalias() = inputs * weights.transpose();
+    }
+};
+
+
+
+struct Linear
+{
+    Linear(rowVector const&){}
+    double activate(double val) const {return val;}
+    double prime(double) const {return 1;}
+};
+
+
+
+struct Sigmoid
+{
+    Sigmoid(rowVector const&){}
+    double activate(double val) const {return 1 / (1 + std::exp(-val));}
+    double prime(double val) const {return val * (1 - val);}
+};
+
+
+
+struct Tanh
+{
+    Tanh(rowVector const&){}
+    double activate(double val) const {return std::tanh(val);}
+    double prime(double val) const {return -1 / (std::cosh(val) * std::cosh(val));}
+};
+
+
+
+struct Softplus
+{
+    Softplus(rowVector const&){}
+    double activate(double val) const {return std::log(std::exp(val) + 1);}
+    double prime(double val) const {return 1 / (1 + std::exp(-val));}
+};
+
+
+
+//also used for Prelu
+struct Relu
+{
+    Relu(rowVector const& coefs): coef(coefs[0]){}
+    double activate(double val) const {return std::max(val, 0.0) + coef * std::min(val, 0.0);}
+    double prime(double val) const {return (val < 0 ? coef : 1);}
+    double coef;
+};
+
+
+
+//also used for Pelu
+struct Elu
+{
+    Elu(rowVector const& coefs): coef(coefs[0]){}
+    double activate(double val) const {return (val < 0 ? coef*(std::exp(val)-1) : val);}
+    double prime(double val) const {return (val < 0 ? coef * std::exp(val) : 1);}
+    double coef;
+};
+
+
+
+} // namespace kernel
+
+
+
+template<typename Aggr, typename Act>
+class LayerKernel : public Kernel
+{
+public:
+    void process(Eigen::Ref<Matrix const> const& inputs, Eigen::Map<Matrix const> const& weights, Eigen::Map<Vector const> const& bias, rowVector const& coefs, Eigen::Ref<Matrix> output) const
+    {
+        Aggr::aggregate(inputs, weights, view(output));
+        Act const act(coefs);
+        double const* biasData = bias.data();
+        for(eigen_size_t i = 0; i < output.rows(); i++)
+        {
+            double* line = output.row(i).data();
+            for(eigen_size_t j = 0; j < output.cols(); j++)
+                line[j] = act.activate(line[j] + biasData[j]);
+        }
+    }
+
+    void prime(Eigen::Ref<Matrix> values, rowVector const& coefs) const
+    {
+        Act const act(coefs);
+        for(eigen_size_t i = 0; i < values.rows(); i++)
+        {
+            double* line = values.row(i).data();
+            for(eigen_size_t j = 0; j < values.cols(); j++)
+                line[j] = act.prime(line[j]);
+        }
+    }
+};
+
+
+
+//specialized kernels, indexed by (aggregation id, activation id).
+//combinations that are not listed use the generic (virtual) path of the layer
+static std::map<std::pair<size_t, size_t>, std::function<std::shared_ptr<Kernel const>()>> kernelMap = {
+    {{Aggregation::Dot, Activation::Linear}, []{return std::make_shared<LayerKernel<kernel::Dot, kernel::Linear>>();}},
+    {{Aggregation::Dot, Activation::Sigmoid}, []{return std::make_shared<LayerKernel<kernel::Dot, kernel::Sigmoid>>();}},
+    {{Aggregation::Dot, Activation::Tanh}, []{return std::make_shared<LayerKernel<kernel::Dot, kernel::Tanh>>();}},
+    {{Aggregation::Dot, Activation::Softplus}, []{return std::make_shared<LayerKernel<kernel::Dot, kernel::Softplus>>();}},
+    {{Aggregation::Dot, Activation::Relu}, []{return std::make_shared<LayerKernel<kernel::Dot, kernel::Relu>>();}},
+    {{Aggregation::Dot, Activation::Prelu}, []{return std::make_shared<LayerKernel<kernel::Dot, kernel::Relu>>();}},
+    {{Aggregation::Dot, Activation::Elu}, []{return std::make_shared<LayerKernel<kernel::Dot, kernel::Elu>>();}},
+    {{Aggregation::Dot, Activation::Pelu}, []{return std::make_shared<LayerKernel<kernel::Dot, kernel::Elu>>();}}
+};
+
+
+
+} //namespace omnilearn
+
+
+
+#endif //OMNILEARN_LAYERKERNEL_HH_
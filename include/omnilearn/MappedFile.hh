@@ -0,0 +1,47 @@
+// MappedFile.hh
+
+#ifndef OMNILEARN_MAPPEDFILE_HH_
+#define OMNILEARN_MAPPEDFILE_HH_
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "Exception.hh"
+
+
+
+namespace omnilearn
+{
+
+
+
+//read-only view of a whole file, memory-mapped when the platform allows it
+class MappedFile
+{
+public:
+    MappedFile(std::string const& path);
+    MappedFile(MappedFile const&) = delete;
+    MappedFile& operator=(MappedFile const&) = delete;
+    ~MappedFile();
+    char const* data() const;
+    size_t size() const;
+
+protected:
+    char const* _data;
+    size_t _size;
+    std::vector<char> _buffer; //file content when mapping is not available
+};
+
+
+
+//offset rounded up to a 64 bytes boundary, where the blocks of the binary files start
+size_t align64(size_t offset);
+//true if a rows x cols block of doubles starting at offset ends before size, checked without overflow
+bool blockFits(size_t offset, uint64_t rows, uint64_t cols, size_t size);
+
+
+
+} // namespace omnilearn
+
+#endif // OMNILEARN_MAPPEDFILE_HH_
@@ -11,6 +11,7 @@ DISABLE_WARNING_EXTRA
 DISABLE_WARNING_OLD_STYLE_CAST
 DISABLE_WARNING_CONVERSION
 #include "eigen/Core"
+#include "eigen/SparseCore"
 DISABLE_WARNING_POP
 
 #define eigen_size_t long long
@@ -25,11 +26,18 @@ namespace omnilearn
 using Matrix = Eigen::Matrix<double, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor>;
 using Vector = Eigen::Matrix<double, Eigen::Dynamic, 1>;
 using rowVector = Eigen::Matrix<double, 1, Eigen::Dynamic>;
+//compressed sparse rows, one line per feature
+using SparseMatrix = Eigen::SparseMatrix<double, Eigen::RowMajor>;
 
 
 double dev(Vector const& vec);
 double norm(Vector const& vec, double order = 2);
 double normInf(Vector const& vec);
+//dest = lhs * rhs^T without heap allocation (the blocked product of Eigen allocates its workspace on large matrices):
+//one matrix-vector product per line, the coefficient-based product being much slower once built with -Os
+void multiplyTransposed(Eigen::Ref<Matrix const> const& lhs, Eigen::Ref<Matrix const> const& rhs, Eigen::Ref<Matrix> dest);
+//new Ref on the coefficients of ref, to pass it on: the implicit copy constructor of Ref is deprecated
+inline Eigen::Ref<Matrix> view(Eigen::Ref<Matrix>& ref) {return ref.topLeftCorner(ref.rows(), ref.cols());}
 
 
 } // namespace omnilearn
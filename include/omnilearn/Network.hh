@@ -7,10 +7,17 @@
 #include "cost.hh"
 #include "decay.hh"
 #include "metric.hh"
+#include "preprocess.hh"
 #include "csv.hh"
 #include "fileString.hh"
+#include "Prefetcher.hh"
 
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <future>
 #include <iostream>
+#include <memory>
 #include <utility>
 
 
@@ -22,6 +29,10 @@ enum class Loss {L1, L2, CrossEntropy, BinaryCrossEntropy};
 enum class Metric {L1, L2, Accuracy};
 enum class Preprocess {Center, Normalize, Standardize, Decorrelate, Whiten, Reduce};
 enum class Decay {None, Inverse, Exp, Step, Plateau};
+//Layer: each layer splits its work between threads
+//Data: each thread processes a slice of the batch with its own copy of the layers
+//Hogwild: each thread learns whole batches and updates the shared layers without lock (asynchronous)
+enum class Parallelism {Layer, Data, Hogwild};
 
 
 
@@ -55,9 +66,16 @@ struct NetworkParam
     decay(Decay::None),
     classValidity(0.9),
     threads(1),
+    parallelism(Parallelism::Layer),
+    streamBlockSize(4096),
+    streamShuffleBlocks(8),
+    streamReservoir(10000),
+    prefetchDepth(2),
+    checkpointInterval(0),
     optimizer(Optimizer::None),
     momentum(0.9),
     window(0.9),
+    adamWindow(0.999),
     plateau(0.99),
     preprocessInputs(),
     preprocessOutputs(),
@@ -86,9 +104,16 @@ struct NetworkParam
     Decay decay;
     double classValidity;
     size_t threads;
+    Parallelism parallelism;
+    size_t streamBlockSize; //features read at once from a streaming source
+    size_t streamShuffleBlocks; //blocks whose features are mixed together when streaming
+    size_t streamReservoir; //maximum number of validation (and test) features drawn from a streaming source
+    size_t prefetchDepth; //batches (or streamed windows) prepared in background while learning, 0 to disable
+    size_t checkpointInterval; //epochs between two checkpoints (name.checkpoint), 0 to disable
     Optimizer optimizer;
     double momentum; //momentum
     double window; //window effect on grads
+    double adamWindow; //window on the second moment of Adam, Adamax, Nadam and AmsGrad, instead of window
     double plateau;
     std::vector<Preprocess> preprocessInputs;
     std::vector<Preprocess> preprocessOutputs;
@@ -113,31 +138,116 @@ struct NetworkParam
 
 class Network
 {
+  friend class InferenceSession;
+
 public:
-  Network(Data const& data, NetworkParam const& param);
-  Network(NetworkParam const& param, Data const& data);
+  //the data are moved in the network if given as rvalue
+  Network(Data data, NetworkParam const& param);
+  Network(NetworkParam const& param, Data data);
+  //loads path.omnimodel if it exists, path.out and path.save otherwise
   Network(std::string const& path, size_t threads);
+  //the data are read block by block from the source at each epoch instead of being kept in memory
+  Network(std::shared_ptr<DataSource const> const& source, NetworkParam const& param);
   void addLayer(LayerParam const& param, size_t aggregation, size_t activation);
   void setTestData(Data const& data);
   bool learn();
+  //continues the training saved in a checkpoint, the network must have the same data, parameters and layers.
+  //warmStart: starts a new training from the model of a checkpoint or of an .omnimodel file
+  bool resume(std::string const& path, bool warmStart = false);
+  //large batches are split in row blocks going through all the layers, smaller ones are processed layer by layer
   Matrix process(Matrix inputs) const;
+  //only if the network has been trained on sparse inputs (no input preprocessing)
+  Matrix process(SparseMatrix const& inputs) const;
+  //number of raw inputs of a feature
+  size_t inputSize() const;
+  //folds the input preprocessing in the first layer (dot or maxout aggregation) and the output preprocessing
+  //in the last one (dot aggregation and linear activation, no cross-entropy), process then only runs the layers.
+  //Returns false if some steps can't be folded, they are still applied. The network is only meant to be used, not to learn
+  bool foldPreprocessing();
   void writeInfo(std::string const& path) const;
   void saveNetInFile(std::string const& path) const;
+  //binary model (.omnimodel): topology, coefficients and preprocessing, loaded without parsing
+  void saveNetInBinaryFile(std::string const& path) const;
   Vector generate(NetworkParam param, Vector target, Vector input = Vector(0));
 
 protected:
+  void loadNetFromBinaryFile(std::string const& path);
+  void writePreprocessBlocks(std::ofstream& file, size_t& offset) const;
+  void readPreprocessBlocks(MappedFile const& file, size_t& offset, std::string const& path);
+  //the preprocessing read from path must fit the raw inputs and outputs, returns their preprocessed dimensions
+  std::pair<size_t, size_t> checkPreprocessBlocks(std::string const& path, size_t inputs, size_t outputs) const;
+  //saved: parameters of the last snapshot instead of the current ones
+  void writeLayerBlocks(std::ofstream& file, size_t& offset, bool saved) const;
+  //written aside then renamed, the previous file stays valid if the process dies meanwhile
+  void writeModelFile(std::string const& path, bool saved) const;
+  void readLayerBlocks(MappedFile const& file, size_t& offset, std::string const& path, size_t layers, bool create);
+  void saveCheckpoint(std::string const& path, double lowestLoss) const;
+  //splits and preprocesses the data, statistics are not computed again if false
+  void prepareData(bool statistics);
+  //initializes the layers and the metric normalization
+  void initLearning();
+  //learns from epoch firstEpoch until the end or early stopping, then saves the best model
+  bool train(size_t firstEpoch, double lowestLoss);
   void initLayers();
   void shuffleTrainData();
   void shuffleData();
-  void preprocess();
+  void preprocess(bool statistics);
+  //streaming counterpart of shuffleData and preprocess
+  void initStream(bool statistics);
+  static void checkPreprocess(std::vector<Preprocess> const& steps, bool outputs);
+  static bool needsStatistics(Preprocess step);
+  void setInputPreprocess(size_t step, StreamingStats const& stats);
+  void setOutputPreprocess(size_t step, StreamingStats const& stats);
+  //applies the preprocessing steps [first, last)
+  void preprocessInputs(Matrix& inputs, size_t first, size_t last) const;
+  void preprocessOutputs(Matrix& outputs, size_t first, size_t last) const;
   void performeOneEpoch();
-  //process taking already processed inputs and giving processed outputs
-  Matrix processForLoss(Matrix inputs) const;
+  void performeHogwildEpoch(eigen_size_t batchSize, double lr);
+  void performeStreamingEpoch(double lr);
+  //copies the features of a batch, taken in the current training order (in sparseInputs if the inputs are sparse)
+  void gatherBatch(size_t batch, eigen_size_t batchSize, Prefetcher::Batch& data) const;
+  //indexes of all the blocks of the source, in order
+  std::vector<size_t> streamBlocks() const;
+  //reads the training features of blocks [first, first+streamShuffleBlocks) of the list,
+  //after applying the first inputSteps and outputSteps preprocessing steps
+  void readTrainWindow(std::vector<size_t> const& blocks, size_t first, size_t inputSteps, size_t outputSteps, Matrix& inputs, Matrix& outputs) const;
+  //calls func on each non-empty window of the blocks, the next windows are read in background
+  void streamTrainData(std::vector<size_t> const& blocks, size_t inputSteps, size_t outputSteps, std::function<void(Matrix&, Matrix&)> const& func) const;
+  //gradients of a batch are accumulated in the layers, split between replicas in data-parallel mode
+  //inputs are a Matrix or a SparseMatrix
+  template<typename Inputs> void accumulateGradients(Inputs const& input, Matrix const& output);
+  void updateLayers(double lr);
+  //forward and backward pass of a batch, gradients are accumulated in the layers
+  template<typename Inputs> void backpropagate(std::vector<Layer>& layers, Inputs const& input, Matrix const& output, std::mt19937& generator, std::bernoulli_distribution& dropoutDist, std::bernoulli_distribution& dropconnectDist, ThreadPool& t);
+  //process taking already processed inputs and giving processed outputs, starting at layer firstLayer
+  Matrix processForLoss(Matrix inputs, size_t firstLayer = 0) const;
+  Matrix processForLoss(SparseMatrix const& inputs) const;
+  //transforms processed outputs to real values
+  Matrix postprocess(Matrix outputs) const;
+  //true if the batch gives a few cache-sized row blocks per thread, and no layer uses distance aggregation
+  bool rowParallel(size_t rows) const;
+  //each thread runs its row blocks through all the layers with its own InferenceSession
+  Matrix processRowBlocks(Matrix const& inputs) const;
+  //undoes an output preprocessing step, only its linear part if offset is false
+  void restoreOutputs(Matrix& outputs, size_t step, bool offset) const;
+  //the preprocessing steps composed in one affine map: preprocessed = raw * first + second
+  std::pair<Matrix, rowVector> inputMap() const;
+  //the restoring steps composed in one affine map: restored = outputs * first + second
+  std::pair<Matrix, rowVector> outputMap() const;
+  //outputs of the raw test features
+  Matrix processTestData() const;
+  bool sparseInputs() const;
+  //decay of the second moment given to the optimizer
+  double optimizerWindow() const;
   Matrix computeLossMatrix(Matrix const& realResult, Matrix const& predicted);
   Vector computeGradVector(Vector const& realResult, Vector const& predicted);
+  Matrix computeGradMatrix(Matrix const& realResult, Matrix const& predicted, ThreadPool& t);
   //return validation loss
   double computeLoss();
+  //snapshot of the best parameters, taken in background
   void save();
+  //waits for the copy of the last snapshot, and for the writing of its file if written
+  void waitSnapshot(bool written);
   void loadSaved();
 
 protected:
@@ -155,15 +265,26 @@ protected:
 
   //threadpool for parallelization
   mutable ThreadPool _pool;
-
-  //data
-  Matrix _trainInputs;
-  Matrix _trainOutputs;
-  Matrix _validationInputs;
-  Matrix _validationOutputs;
-  Matrix _testInputs;
-  Matrix _testOutputs;
+  //pool without worker, its loops run on the calling thread (used by data-parallel replicas)
+  mutable ThreadPool _serialPool;
+
+  //copies of the layers used by data-parallel and hogwild training, one per thread
+  std::vector<std::vector<Layer>> _replicas;
+
+  //source of the data when streaming, validation and test features (sorted) are excluded from training
+  std::shared_ptr<DataSource const> _source;
+  std::vector<size_t> _heldOut;
+
+  //data, stored once: the training features (none when streaming), then the validation features.
+  //test features are kept apart because they are not preprocessed
+  size_t _trainSize;
+  size_t _validationSize;
+  std::vector<size_t> _trainOrder; //order of the training features in the current epoch
+  Matrix _inputs;
+  SparseMatrix _sparseInputs; //used instead of _inputs if the data are sparse
+  Matrix _outputs;
   Matrix _testRawInputs;
+  SparseMatrix _testRawSparseInputs;
   Matrix _testRawOutputs;
   Matrix _testNormalizedOutputsForMetric;
 
@@ -191,6 +312,11 @@ protected:
   std::vector<std::pair<double, double>> _inputNormalization;
   std::vector<std::pair<double, double>> _inputStandartization;
   std::pair<Matrix, Vector> _inputDecorrelation;
+
+  //last snapshot: the whole task (copy then file), and the copy only.
+  //Declared last so that a running snapshot ends before the other members are destroyed
+  std::future<void> _snapshot;
+  std::future<void> _snapshotCopy;
 };
 
 
@@ -0,0 +1,65 @@
+// Prefetcher.hh
+
+#ifndef OMNILEARN_PREFETCHER_HH_
+#define OMNILEARN_PREFETCHER_HH_
+
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "Matrix.hh"
+
+
+
+namespace omnilearn
+{
+
+
+
+//prepares the next batches in a background thread while the current one is used.
+//batch buffers are reused, so they are not reallocated once they have reached their size
+class Prefetcher
+{
+public:
+    struct Batch
+    {
+        Matrix inputs;
+        SparseMatrix sparseInputs;
+        Matrix outputs;
+    };
+
+    //producer fills the given batch and returns false when there is nothing left.
+    //depth is the number of batches prepared in advance, 0 runs the producer in next()
+    Prefetcher(size_t depth, std::function<bool(Batch&)> producer);
+    Prefetcher(Prefetcher const&) = delete;
+    Prefetcher& operator=(Prefetcher const&) = delete;
+    ~Prefetcher();
+    //next batch, nullptr when the producer is done. The batch returned before is given back to the producer
+    Batch* next();
+
+protected:
+    void run();
+
+protected:
+    std::function<bool(Batch&)> _producer;
+    std::vector<Batch> _batches;
+    std::deque<size_t> _free;
+    std::deque<size_t> _ready;
+    size_t _current; //batch used by the consumer
+    bool _done;
+    bool _stop;
+    std::exception_ptr _error;
+    std::mutex _mutex;
+    std::condition_variable _condition;
+    std::thread _thread;
+};
+
+
+
+} // namespace omnilearn
+
+#endif // OMNILEARN_PREFETCHER_HH_
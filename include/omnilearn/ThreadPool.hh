@@ -1,17 +1,20 @@
-// progschj/ThreadPool
+// progschj/ThreadPool, turned into a work-stealing pool
 
 #ifndef OMNILEARN_THREAD_POOL_HH_
 #define OMNILEARN_THREAD_POOL_HH_
 
 #include <vector>
-#include <queue>
+#include <deque>
 #include <memory>
 #include <thread>
 #include <mutex>
+#include <atomic>
 #include <condition_variable>
 #include <future>
 #include <functional>
 #include <stdexcept>
+#include <algorithm>
+#include <exception>
 
 
 
@@ -20,49 +23,116 @@ namespace omnilearn
 
 
 
+// blocks until count_down has been called count times
+class Latch
+{
+public:
+  Latch(size_t n): count(n) {}
+  void count_down();
+  bool done();
+  void wait();
+
+private:
+  size_t count;
+  std::mutex mutex;
+  std::condition_variable condition;
+};
+
+
+
 class ThreadPool
 {
 public:
-  ThreadPool(size_t);
+  // spin is the number of times an idle worker looks for work before sleeping
+  ThreadPool(size_t threads, size_t spin = 0);
   template<class F, class... Args>
   auto enqueue(F&& f, Args&&... args) -> std::future<typename std::result_of<F(Args...)>::type>;
+  // calls fn(chunkBegin, chunkEnd) on chunks of [begin, end) holding at least grain elements.
+  // the caller runs the first chunk, a range that fits in one chunk runs inline
+  template<class F>
+  void parallel_for(size_t begin, size_t end, size_t grain, F&& fn);
+  // fn(chunkBegin, chunkEnd) returns the partial result of a chunk, partial results
+  // are combined with op in chunk order, so the result only depends on the number of threads
+  template<class T, class F, class Op>
+  T parallel_reduce(size_t begin, size_t end, size_t grain, T const& identity, F&& fn, Op&& op);
+  // grain giving chunks of at least a few thousand operations
+  static size_t grain(size_t workPerElement);
   size_t size() const;
   ~ThreadPool();
 
 private:
+  // each worker pops its own tasks from the back and steals the others' from the front
+  struct WorkQueue
+  {
+    std::mutex mutex;
+    std::deque<std::function<void()>> tasks;
+  };
+
+  size_t chunkCount(size_t elements, size_t grain) const;
+  void push(size_t queue, std::function<void()> task);
+  // queue used by the calling thread: its own if it is a worker, round robin otherwise
+  size_t submitQueue();
+  // pops a task from queue first, then steals from the other ones
+  bool pop(size_t queue, std::function<void()>& task);
+  // runs queued tasks until the latch is done, then waits for the remaining ones
+  void helpUntil(Latch& latch);
+  void wake(bool all);
+  // pool and queue index of the calling thread, if it is a worker
+  static std::pair<ThreadPool const*, size_t>& workerId();
+
   // need to keep track of threads so we can join them
   std::vector<std::thread> workers;
-  // the task queue
-  std::queue<std::function<void()>> tasks;
+  // one task queue per worker
+  std::vector<std::unique_ptr<WorkQueue>> queues;
+  std::atomic<size_t> pending;
+  std::atomic<size_t> nextQueue;
+  size_t spin;
 
-  // synchronization
-  std::mutex queue_mutex;
+  // synchronization of the sleeping workers
+  std::mutex sleep_mutex;
   std::condition_variable condition;
-  bool stop;
+  std::atomic<bool> stop;
 };
 
 
 // the constructor just launches some amount of workers
-inline ThreadPool::ThreadPool(size_t threads): stop(false)
+inline ThreadPool::ThreadPool(size_t threads, size_t spinCount):
+workers(),
+queues(),
+pending(0),
+nextQueue(0),
+spin(spinCount),
+sleep_mutex(),
+condition(),
+stop(false)
 {
+  for(size_t i = 0; i < threads; ++i)
+    queues.emplace_back(new WorkQueue);
   for(size_t i = 0; i < threads; ++i)
   {
     workers.emplace_back(
-      [this]
+      [this, i]
       {
+        workerId() = {this, i};
         for(;;)
         {
           std::function<void()> task;
+          bool found = pop(i, task);
+          for(size_t s = 0; !found && s < spin; ++s)
+          {
+            std::this_thread::yield();
+            found = pop(i, task);
+          }
+          if(found)
           {
-            std::unique_lock<std::mutex> lock(this->queue_mutex);
-            this->condition.wait(lock,
-              [this]{ return this->stop || !this->tasks.empty(); });
-            if(this->stop && this->tasks.empty())
-              return;
-            task = std::move(this->tasks.front());
-            this->tasks.pop();
+            task();
+            continue;
           }
-          task();
+          std::unique_lock<std::mutex> lock(this->sleep_mutex);
+          this->condition.wait(lock,
+            [this]{ return this->stop || this->pending > 0; });
+          if(this->stop && this->pending == 0)
+            return;
         }
       }
     );
@@ -79,17 +149,208 @@ auto ThreadPool::enqueue(F&& f, Args&&... args) -> std::future<typename std::res
               std::bind(std::forward<F>(f), std::forward<Args>(args)...));
 
   std::future<return_type> res = task->get_future();
+  push(submitQueue(), [task](){ (*task)(); });
+  wake(false);
+  return res;
+}
+
+
+// run fn on every chunk, the caller executes queued tasks until all chunks are done
+template<class F>
+void ThreadPool::parallel_for(size_t begin, size_t end, size_t grain, F&& fn)
+{
+  if(end <= begin)
+    return;
+  size_t chunks = chunkCount(end - begin, grain);
+  if(chunks == 1)
+  {
+    fn(begin, end);
+    return;
+  }
+  size_t chunkSize = (end - begin + chunks - 1) / chunks;
+  chunks = (end - begin + chunkSize - 1) / chunkSize;
+
+  Latch latch(chunks);
+  std::exception_ptr error;
+  std::mutex errorMutex;
+  auto run = [&fn, &latch, &error, &errorMutex](size_t chunkBegin, size_t chunkEnd)
+  {
+    try
+    {
+      fn(chunkBegin, chunkEnd);
+    }
+    catch(...)
+    {
+      std::unique_lock<std::mutex> lock(errorMutex);
+      if(!error)
+        error = std::current_exception();
+    }
+    latch.count_down();
+  };
+
+  // spread the chunks over the queues so that workers start without stealing
+  size_t first = submitQueue();
+  for(size_t i = 1; i < chunks; ++i)
+  {
+    size_t chunkBegin = begin + i * chunkSize;
+    size_t chunkEnd = std::min(end, chunkBegin + chunkSize);
+    push((first + i) % queues.size(), [&run, chunkBegin, chunkEnd](){ run(chunkBegin, chunkEnd); });
+  }
+  wake(true);
+  run(begin, begin + chunkSize);
+  helpUntil(latch);
+  if(error)
+    std::rethrow_exception(error);
+}
+
+
+template<class T, class F, class Op>
+T ThreadPool::parallel_reduce(size_t begin, size_t end, size_t grain, T const& identity, F&& fn, Op&& op)
+{
+  if(end <= begin)
+    return identity;
+  size_t chunks = chunkCount(end - begin, grain);
+  size_t chunkSize = (end - begin + chunks - 1) / chunks;
+  chunks = (end - begin + chunkSize - 1) / chunkSize;
+
+  std::vector<T> partials(chunks, identity);
+  parallel_for(0, chunks, 1, [&fn, &partials, begin, end, chunkSize](size_t first, size_t last)
+  {
+    for(size_t i = first; i < last; ++i)
+      partials[i] = fn(begin + i * chunkSize, std::min(end, begin + (i + 1) * chunkSize));
+  });
+  T result = identity;
+  for(size_t i = 0; i < chunks; ++i)
+    result = op(result, partials[i]);
+  return result;
+}
+
+
+inline size_t ThreadPool::grain(size_t workPerElement)
+{
+  return std::max(static_cast<size_t>(1), static_cast<size_t>(16384) / std::max(static_cast<size_t>(1), workPerElement));
+}
+
+
+// a few chunks per worker to balance the load, none smaller than grain
+inline size_t ThreadPool::chunkCount(size_t elements, size_t grain) const
+{
+  size_t chunks = (elements + std::max(static_cast<size_t>(1), grain) - 1) / std::max(static_cast<size_t>(1), grain);
+  return std::max(static_cast<size_t>(1), std::min(chunks, 4 * workers.size()));
+}
+
+
+inline void ThreadPool::push(size_t queue, std::function<void()> task)
+{
   {
-    std::unique_lock<std::mutex> lock(queue_mutex);
+    std::unique_lock<std::mutex> lock(queues[queue]->mutex);
 
     // don't allow enqueueing after stopping the pool
     if(stop)
       throw std::runtime_error("enqueue on stopped ThreadPool");
 
-    tasks.emplace([task](){ (*task)(); });
+    // counted before being visible so that pending never goes below the number of queued tasks
+    ++pending;
+    queues[queue]->tasks.push_back(std::move(task));
   }
-  condition.notify_one();
-  return res;
+}
+
+
+inline size_t ThreadPool::submitQueue()
+{
+  if(queues.empty())
+    throw std::runtime_error("enqueue on ThreadPool without worker");
+  std::pair<ThreadPool const*, size_t> const& id = workerId();
+  if(id.first == this)
+    return id.second;
+  return nextQueue++ % queues.size();
+}
+
+
+inline bool ThreadPool::pop(size_t queue, std::function<void()>& task)
+{
+  if(pending == 0)
+    return false;
+  {
+    std::unique_lock<std::mutex> lock(queues[queue]->mutex);
+    if(!queues[queue]->tasks.empty())
+    {
+      task = std::move(queues[queue]->tasks.back());
+      queues[queue]->tasks.pop_back();
+      --pending;
+      return true;
+    }
+  }
+  for(size_t i = 1; i < queues.size(); ++i)
+  {
+    WorkQueue& victim = *queues[(queue + i) % queues.size()];
+    std::unique_lock<std::mutex> lock(victim.mutex);
+    if(!victim.tasks.empty())
+    {
+      task = std::move(victim.tasks.front());
+      victim.tasks.pop_front();
+      --pending;
+      return true;
+    }
+  }
+  return false;
+}
+
+
+inline void ThreadPool::helpUntil(Latch& latch)
+{
+  std::pair<ThreadPool const*, size_t> const& id = workerId();
+  size_t queue = (id.first == this ? id.second : 0);
+  while(!latch.done())
+  {
+    std::function<void()> task;
+    if(!pop(queue, task))
+      break;
+    task();
+  }
+  latch.wait();
+}
+
+
+inline void ThreadPool::wake(bool all)
+{
+  // taking the lock makes sure a worker checking pending is either awake or waiting
+  {
+    std::unique_lock<std::mutex> lock(sleep_mutex);
+  }
+  if(all)
+    condition.notify_all();
+  else
+    condition.notify_one();
+}
+
+
+inline std::pair<ThreadPool const*, size_t>& ThreadPool::workerId()
+{
+  static thread_local std::pair<ThreadPool const*, size_t> id(nullptr, 0);
+  return id;
+}
+
+
+inline void Latch::count_down()
+{
+  std::unique_lock<std::mutex> lock(mutex);
+  if(--count == 0)
+    condition.notify_all();
+}
+
+
+inline bool Latch::done()
+{
+  std::unique_lock<std::mutex> lock(mutex);
+  return count == 0;
+}
+
+
+inline void Latch::wait()
+{
+  std::unique_lock<std::mutex> lock(mutex);
+  condition.wait(lock, [this]{ return count == 0; });
 }
 
 
@@ -103,7 +364,7 @@ inline size_t ThreadPool::size() const
 inline ThreadPool::~ThreadPool()
 {
   {
-    std::unique_lock<std::mutex> lock(queue_mutex);
+    std::unique_lock<std::mutex> lock(sleep_mutex);
     stop = true;
   }
   condition.notify_all();
@@ -117,4 +378,4 @@ inline ThreadPool::~ThreadPool()
 
 
 
-#endif // OMNILEARN_THREAD_POOL_HH_
\ No newline at end of file
+#endif // OMNILEARN_THREAD_POOL_HH_
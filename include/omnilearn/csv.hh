@@ -4,8 +4,10 @@
 #define OMNILEARN_CSV_HH_
 
 #include <fstream>
+#include <memory>
 
 #include "Exception.hh"
+#include "MappedFile.hh"
 #include "Matrix.hh"
 #include "ThreadPool.hh"
 
@@ -20,12 +22,14 @@ struct Data
 {
   Data():
   inputs(),
+  sparseInputs(),
   outputs(),
   inputLabels(0),
   outputLabels(0)
   {}
 
   Matrix inputs;
+  SparseMatrix sparseInputs; //used instead of inputs if it has columns
   Matrix outputs;
   std::vector<std::string> inputLabels;
   std::vector<std::string> outputLabels;
@@ -33,7 +37,82 @@ struct Data
 
 
 
-Data loadData(std::string const& path, char separator, size_t threads = 1);
+//dataset memory-mapped from a binary (.omnidata) file, the matrices are views on the file
+struct MappedData
+{
+  MappedData(std::string const& path);
+  Data toData() const;
+
+  std::shared_ptr<MappedFile const> file;
+  size_t sourceHash; //hash of the csv the data come from (0 if none)
+  Eigen::Map<Matrix const> inputs;
+  Eigen::Map<Matrix const> outputs;
+  std::vector<std::string> inputLabels;
+  std::vector<std::string> outputLabels;
+};
+
+
+
+//dataset read by blocks of consecutive features, so that it never has to fit in memory.
+//read must be callable from several threads at once
+class DataSource
+{
+public:
+  virtual ~DataSource() = default;
+  //number of features
+  virtual size_t size() const = 0;
+  virtual std::vector<std::string> const& inputLabels() const = 0;
+  virtual std::vector<std::string> const& outputLabels() const = 0;
+  //copies the features [first, first+count) in inputs and outputs, which are resized
+  virtual void read(size_t first, size_t count, Matrix& inputs, Matrix& outputs) const = 0;
+};
+
+
+
+//features are copied from the memory-mapped file, only the pages being read are loaded
+class BinaryDataSource : public DataSource
+{
+public:
+  BinaryDataSource(std::string const& path);
+  size_t size() const override;
+  std::vector<std::string> const& inputLabels() const override;
+  std::vector<std::string> const& outputLabels() const override;
+  void read(size_t first, size_t count, Matrix& inputs, Matrix& outputs) const override;
+
+private:
+  MappedData _data;
+};
+
+
+
+//features are parsed from the memory-mapped csv at each read.
+//the position of one line every indexStep lines is kept to start reading anywhere
+class CsvDataSource : public DataSource
+{
+public:
+  CsvDataSource(std::string const& path, char separator, size_t indexStep = 256);
+  size_t size() const override;
+  std::vector<std::string> const& inputLabels() const override;
+  std::vector<std::string> const& outputLabels() const override;
+  void read(size_t first, size_t count, Matrix& inputs, Matrix& outputs) const override;
+
+private:
+  std::shared_ptr<MappedFile const> _file;
+  char _separator;
+  size_t _indexStep;
+  size_t _size;
+  std::vector<char const*> _index;
+  std::vector<std::string> _inputLabels;
+  std::vector<std::string> _outputLabels;
+};
+
+
+
+//if cache is true, the parsed data are saved next to the csv (path + ".omnidata")
+//and reused while the size and modification time of the csv don't change
+Data loadData(std::string const& path, char separator, size_t threads = 1, bool cache = false);
+void saveData(Data const& data, std::string const& path, size_t sourceHash = 0);
+MappedData loadDataBinary(std::string const& path);
 
 
 
@@ -7,8 +7,11 @@
 #include <fstream>
 #include <iterator>
 #include <string>
+#include <string_view>
 #include <vector>
 
+#include "Exception.hh"
+
 
 
 namespace omnilearn
@@ -21,6 +24,14 @@ std::vector<std::string> split(std::string str, char c);
 std::string removeRepetition(std::string const& str, char c);
 std::vector<std::string> readLines(std::string path);
 std::vector<std::string> readCleanLines(std::string path);
+//lines of content (views on it), without the trimmed characters at their ends
+std::vector<std::string_view> splitLines(std::string_view content, std::string_view trimmed);
+//numbers separated by any number of spaces, tabs or commas
+std::vector<double> parseNumbers(std::string_view str);
+double parseNumber(std::string_view str);
+//shortest representation that reads back to the same value
+void appendNumber(std::string& str, double value);
+std::string toString(double value);
 
 
 
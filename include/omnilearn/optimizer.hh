@@ -0,0 +1,163 @@
+// optimizer.hh
+
+#ifndef OMNILEARN_OPTIMIZER_HH_
+#define OMNILEARN_OPTIMIZER_HH_
+
+#include "Matrix.hh"
+
+#include <cmath>
+
+
+
+namespace omnilearn
+{
+
+
+
+enum class Optimizer {None, Momentum, Nesterov, Adagrad, Rmsprop, Adam, Adamax, Nadam, AmsGrad};
+
+
+
+//update rules of the optimizers.
+//each rule turns the averaged gradients (step) into the update to add to the parameters,
+//first, second and maxSecond are the moment buffers of these parameters
+namespace optimizer
+{
+
+
+
+struct Rule
+{
+    Rule(double lr, double mom, double win, double eps, size_t iteration):
+    learningRate(lr),
+    momentum(mom),
+    window(win),
+    epsilon(eps),
+    correction1(1 - std::pow(mom, static_cast<double>(iteration))),
+    correction2(1 - std::pow(win, static_cast<double>(iteration)))
+    {
+    }
+
+    double learningRate;
+    double momentum; //decay of the first moment
+    double window; //decay of the second moment
+    double epsilon;
+    double correction1; //bias correction of the first moment
+    double correction2; //bias correction of the second moment
+};
+
+
+
+struct None : public Rule
+{
+    using Rule::Rule;
+    void operator()(Eigen::Map<Vector>& step, Eigen::Map<Vector>&, Eigen::Map<Vector>&, Eigen::Map<Vector>&) const
+    {
+        step *= learningRate;
+    }
+};
+
+
+
+//also used for Nesterov
+struct Momentum : public Rule
+{
+    using Rule::Rule;
+    void operator()(Eigen::Map<Vector>& step, Eigen::Map<Vector>& first, Eigen::Map<Vector>&, Eigen::Map<Vector>&) const
+    {
+        first = learningRate * step - momentum * first;
+        step = first;
+    }
+};
+
+
+
+struct Adagrad : public Rule
+{
+    using Rule::Rule;
+    void operator()(Eigen::Map<Vector>& step, Eigen::Map<Vector>& first, Eigen::Map<Vector>&, Eigen::Map<Vector>&) const
+    {
+        first.array() += step.array().square();
+        step.array() *= learningRate / (first.array().sqrt() + epsilon);
+    }
+};
+
+
+
+struct Rmsprop : public Rule
+{
+    using Rule::Rule;
+    void operator()(Eigen::Map<Vector>& step, Eigen::Map<Vector>& first, Eigen::Map<Vector>&, Eigen::Map<Vector>&) const
+    {
+        first.array() = window * first.array() + (1 - window) * step.array().square();
+        step.array() *= learningRate / (first.array().sqrt() + epsilon);
+    }
+};
+
+
+
+struct Adam : public Rule
+{
+    using Rule::Rule;
+    void operator()(Eigen::Map<Vector>& step, Eigen::Map<Vector>& first, Eigen::Map<Vector>& second, Eigen::Map<Vector>&) const
+    {
+        first.array() = momentum * first.array() + (1 - momentum) * step.array();
+        second.array() = window * second.array() + (1 - window) * step.array().square();
+        step.array() = learningRate * (first.array() / correction1) / ((second.array() / correction2).sqrt() + epsilon);
+    }
+};
+
+
+
+//the second moment is the infinity norm of the gradients
+struct Adamax : public Rule
+{
+    using Rule::Rule;
+    void operator()(Eigen::Map<Vector>& step, Eigen::Map<Vector>& first, Eigen::Map<Vector>& second, Eigen::Map<Vector>&) const
+    {
+        first.array() = momentum * first.array() + (1 - momentum) * step.array();
+        second.array() = (window * second.array()).max(step.array().abs());
+        step.array() = (learningRate / correction1) * first.array() / (second.array() + epsilon);
+    }
+};
+
+
+
+//Adam with a Nesterov look-ahead on the first moment
+struct Nadam : public Rule
+{
+    using Rule::Rule;
+    void operator()(Eigen::Map<Vector>& step, Eigen::Map<Vector>& first, Eigen::Map<Vector>& second, Eigen::Map<Vector>&) const
+    {
+        first.array() = momentum * first.array() + (1 - momentum) * step.array();
+        second.array() = window * second.array() + (1 - window) * step.array().square();
+        step.array() = learningRate * (momentum * first.array() + (1 - momentum) * step.array()) / correction1 / ((second.array() / correction2).sqrt() + epsilon);
+    }
+};
+
+
+
+//Adam using the maximum of all second moments
+struct AmsGrad : public Rule
+{
+    using Rule::Rule;
+    void operator()(Eigen::Map<Vector>& step, Eigen::Map<Vector>& first, Eigen::Map<Vector>& second, Eigen::Map<Vector>& maxSecond) const
+    {
+        first.array() = momentum * first.array() + (1 - momentum) * step.array();
+        second.array() = window * second.array() + (1 - window) * step.array().square();
+        maxSecond.array() = maxSecond.array().max(second.array());
+        step.array() = learningRate * (first.array() / correction1) / ((maxSecond.array() / correction2).sqrt() + epsilon);
+    }
+};
+
+
+
+} // namespace optimizer
+
+
+
+} //namespace omnilearn
+
+
+
+#endif //OMNILEARN_OPTIMIZER_HH_
@@ -43,6 +43,31 @@ void reduce(Matrix& data, std::pair<Matrix, Vector> const& singular, double thre
 
 
 
+//statistics of data given chunk by chunk, giving the same results as the functions above
+//computed on all the chunks at once
+class StreamingStats
+{
+public:
+  //crossProducts is needed for decorrelation
+  StreamingStats(size_t cols, bool crossProducts);
+  void add(Eigen::Ref<Matrix const> data);
+  Vector mean() const;
+  std::vector<std::pair<double, double>> minMax() const;
+  std::vector<std::pair<double, double>> meanDev() const;
+  std::pair<Matrix, Vector> decorrelation() const;
+
+private:
+  double _count;
+  Vector _mean;
+  Vector _m2; //sum of the squared differences to the mean
+  Vector _min;
+  Vector _max;
+  bool _crossProducts;
+  Matrix _xtx;
+};
+
+
+
 } //namespace omnilearn
 
 #endif // OMNILEARN_PREPROCESS_HH_
\ No newline at end of file
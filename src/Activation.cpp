@@ -33,6 +33,18 @@ double omnilearn::Linear::prime([[maybe_unused]] double val) const
 }
 
 
+void omnilearn::Linear::activate([[maybe_unused]] Eigen::Ref<Matrix> values) const
+{
+    //nothing to do
+}
+
+
+void omnilearn::Linear::prime(Eigen::Ref<Matrix> values) const
+{
+    values.setConstant(1);
+}
+
+
 void omnilearn::Linear::learn([[maybe_unused]] double gradient, [[maybe_unused]] double learningRate)
 {
     //nothing to learn
@@ -101,6 +113,18 @@ double omnilearn::Sigmoid::prime(double val) const
 }
 
 
+void omnilearn::Sigmoid::activate(Eigen::Ref<Matrix> values) const
+{
+    values = (1 + (-values.array()).exp()).inverse();
+}
+
+
+void omnilearn::Sigmoid::prime(Eigen::Ref<Matrix> values) const
+{
+    values.array() *= (1 - values.array());
+}
+
+
 void omnilearn::Sigmoid::learn([[maybe_unused]] double gradient, [[maybe_unused]] double learningRate)
 {
     //nothing to learn
@@ -167,6 +191,18 @@ double omnilearn::Tanh::prime(double val) const
 }
 
 
+void omnilearn::Tanh::activate(Eigen::Ref<Matrix> values) const
+{
+    values = values.array().tanh();
+}
+
+
+void omnilearn::Tanh::prime(Eigen::Ref<Matrix> values) const
+{
+    values = -values.array().cosh().square().inverse();
+}
+
+
 void omnilearn::Tanh::learn([[maybe_unused]] double gradient, [[maybe_unused]] double learningRate)
 {
     //nothing to learn
@@ -233,6 +269,18 @@ double omnilearn::Softplus::prime(double val) const
 }
 
 
+void omnilearn::Softplus::activate(Eigen::Ref<Matrix> values) const
+{
+    values = (values.array().exp() + 1).log();
+}
+
+
+void omnilearn::Softplus::prime(Eigen::Ref<Matrix> values) const
+{
+    values = (1 + (-values.array()).exp()).inverse();
+}
+
+
 void omnilearn::Softplus::learn([[maybe_unused]] double gradient, [[maybe_unused]] double learningRate)
 {
     //nothing to learn
@@ -301,6 +349,19 @@ double omnilearn::Relu::prime(double val) const
 }
 
 
+void omnilearn::Relu::activate(Eigen::Ref<Matrix> values) const
+{
+    //branchless: max(x, 0) + coef * min(x, 0)
+    values = values.cwiseMax(0) + _coef * values.cwiseMin(0);
+}
+
+
+void omnilearn::Relu::prime(Eigen::Ref<Matrix> values) const
+{
+    values = (values.array() < 0).select(_coef, Matrix::Ones(values.rows(), values.cols()));
+}
+
+
 void omnilearn::Relu::learn([[maybe_unused]] double gradient, [[maybe_unused]] double learningRate)
 {
     //nothing to learn
@@ -399,6 +460,19 @@ double omnilearn::Elu::prime(double val) const
 }
 
 
+void omnilearn::Elu::activate(Eigen::Ref<Matrix> values) const
+{
+    //branchless: max(x, 0) + coef * (exp(min(x, 0)) - 1)
+    values = values.cwiseMax(0).array() + _coef * (values.cwiseMin(0).array().exp() - 1);
+}
+
+
+void omnilearn::Elu::prime(Eigen::Ref<Matrix> values) const
+{
+    values = (values.array() < 0).select(_coef * values.cwiseMin(0).array().exp(), Matrix::Ones(values.rows(), values.cols()));
+}
+
+
 void omnilearn::Elu::learn([[maybe_unused]] double gradient, [[maybe_unused]] double learningRate)
 {
     //nothing to learn
@@ -489,17 +563,41 @@ omnilearn::Srelu::Srelu(Vector const& coefs)
 }
 
 
+//slope coef1 between the hinges, coef2 below hinge1 and coef3 above hinge2
 double omnilearn::Srelu::activate(double val) const
 {
-    // TO BE IMPLEMENTED
-    return 0;
+    if(val < _hinge1)
+        return _coef1 * _hinge1 + _coef2 * (val - _hinge1);
+    else if(val > _hinge2)
+        return _coef1 * _hinge2 + _coef3 * (val - _hinge2);
+    else
+        return _coef1 * val;
 }
 
 
+//takes the activation result
 double omnilearn::Srelu::prime(double val) const
 {
-    // TO BE IMPLEMENTED
-    return 0;
+    if(val < _coef1 * _hinge1)
+        return _coef2;
+    else if(val > _coef1 * _hinge2)
+        return _coef3;
+    else
+        return _coef1;
+}
+
+
+void omnilearn::Srelu::activate(Eigen::Ref<Matrix> values) const
+{
+    //branchless: the clamped part has slope coef1, the parts beyond the hinges have slopes coef2 and coef3
+    values = _coef1 * values.cwiseMax(_hinge1).cwiseMin(_hinge2).array() + _coef2 * (values.array() - _hinge1).cwiseMin(0) + _coef3 * (values.array() - _hinge2).cwiseMax(0);
+}
+
+
+void omnilearn::Srelu::prime(Eigen::Ref<Matrix> values) const
+{
+    //values are activation results, the hinges are moved accordingly
+    values = (values.array() < _coef1 * _hinge1).select(_coef2, (values.array() > _coef1 * _hinge2).select(_coef3, Matrix::Constant(values.rows(), values.cols(), _coef1)));
 }
 
 
@@ -584,6 +682,18 @@ double omnilearn::Gauss::prime(double val) const
 }
 
 
+void omnilearn::Gauss::activate(Eigen::Ref<Matrix> values) const
+{
+    values = (-values.array().square()).exp();
+}
+
+
+void omnilearn::Gauss::prime(Eigen::Ref<Matrix> values) const
+{
+    values = -2 * values.array() * (-values.array().square()).exp();
+}
+
+
 void omnilearn::Gauss::learn([[maybe_unused]] double gradient, [[maybe_unused]] double learningRate)
 {
     //nothing to learn
@@ -674,6 +784,24 @@ double omnilearn::Psoftexp::prime(double val) const
 }
 
 
+void omnilearn::Psoftexp::activate(Eigen::Ref<Matrix> values) const
+{
+    if(_coef < -std::numeric_limits<double>::epsilon())
+        values = -(1 - (_coef * (values.array() + _coef))).log() / _coef;
+    else if(_coef > std::numeric_limits<double>::epsilon())
+        values = (((_coef * values.array()).exp() - 1) / _coef) + _coef;
+}
+
+
+void omnilearn::Psoftexp::prime(Eigen::Ref<Matrix> values) const
+{
+    if(_coef < 0)
+        values = (1 - (_coef * (_coef + values.array()))).inverse();
+    else
+        values = (_coef * values.array()).exp();
+}
+
+
 void omnilearn::Psoftexp::learn(double gradient, double learningRate)
 {
     //TO BE IMPLEMENTED
@@ -738,6 +866,13 @@ omnilearn::Vector omnilearn::singleSoftmax(Vector input)
 
 
 omnilearn::Matrix omnilearn::softmax(Matrix inputs)
+{
+    softmaxInPlace(inputs);
+    return inputs;
+}
+
+
+void omnilearn::softmaxInPlace(Eigen::Ref<Matrix> inputs)
 {
     for(eigen_size_t i = 0; i < inputs.rows(); i++)
     {
@@ -753,5 +888,4 @@ omnilearn::Matrix omnilearn::softmax(Matrix inputs)
             inputs(i,j) = std::exp(inputs(i,j) - c) / sum;
         }
     }
-    return inputs;
 }
\ No newline at end of file
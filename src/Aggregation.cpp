@@ -113,17 +113,10 @@ omnilearn::Vector omnilearn::Distance::prime(Vector const& inputs, Vector const&
 }
 
 
-//MAYBE WRONG, TO INVESTIGATE
+//the distance is symmetric in inputs and weights
 omnilearn::Vector omnilearn::Distance::primeInput(Vector const& inputs, Vector const& weights) const
 {
-    double a = std::pow(aggregate(inputs, weights, _bias).first, (1-_order));
-    Vector result(weights.size());
-
-    for(eigen_size_t i = 0; i < weights.size(); i++)
-    {
-        result[i] = (-std::pow((inputs[i] - weights[i]), _order-1) * a);
-    }
-    return result;
+    return -prime(inputs, weights);
 }
 
 
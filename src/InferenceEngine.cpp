@@ -0,0 +1,158 @@
+// InferenceEngine.cpp
+
+#include "omnilearn/InferenceEngine.hh"
+
+#include <algorithm>
+
+
+
+//number of recent latencies the percentiles are computed on
+static size_t const latencyWindow = 8192;
+
+
+
+omnilearn::InferenceEngine::InferenceEngine(Network const& network, size_t maxBatch, std::chrono::microseconds budget):
+_network(network),
+_inputSize(network.inputSize()),
+_maxBatch(std::max(static_cast<size_t>(1), maxBatch)),
+_budget(budget),
+_queue(),
+_stop(false),
+_mutex(),
+_condition(),
+_latencies(),
+_requests(0),
+_batches(0),
+_statsMutex(),
+_thread()
+{
+    _latencies.reserve(latencyWindow);
+    _thread = std::thread(&InferenceEngine::run, this);
+}
+
+
+omnilearn::InferenceEngine::~InferenceEngine()
+{
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _stop = true;
+    }
+    _condition.notify_all();
+    _thread.join();
+}
+
+
+std::future<omnilearn::Vector> omnilearn::InferenceEngine::submit(Vector input)
+{
+    if(static_cast<size_t>(input.size()) != _inputSize)
+        throw Exception("The feature has " + std::to_string(input.size()) + " inputs instead of " + std::to_string(_inputSize) + ".");
+    Request request{std::move(input), std::promise<Vector>(), std::chrono::steady_clock::now()};
+    std::future<Vector> result = request.result.get_future();
+    size_t pending = 0;
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        if(_stop)
+            throw Exception("The inference engine is stopped.");
+        _queue.push_back(std::move(request));
+        pending = _queue.size();
+    }
+    //the dispatcher only needs to wake up to start a batch, or when it is full
+    if(pending == 1 || pending >= _maxBatch)
+        _condition.notify_one();
+    return result;
+}
+
+
+omnilearn::InferenceStats omnilearn::InferenceEngine::stats() const
+{
+    std::vector<double> latencies;
+    InferenceStats stats{0, 0, 0, 0};
+    {
+        std::unique_lock<std::mutex> lock(_statsMutex);
+        latencies = _latencies;
+        stats.requests = _requests;
+        stats.batches = _batches;
+    }
+    if(latencies.empty())
+        return stats;
+    auto percentile = [&latencies](double ratio)->double
+    {
+        size_t rank = static_cast<size_t>(ratio * static_cast<double>(latencies.size() - 1));
+        std::nth_element(latencies.begin(), latencies.begin() + static_cast<std::ptrdiff_t>(rank), latencies.end());
+        return latencies[rank];
+    };
+    stats.p50 = percentile(0.5);
+    stats.p99 = percentile(0.99);
+    return stats;
+}
+
+
+void omnilearn::InferenceEngine::run()
+{
+    std::vector<Request> batch;
+    batch.reserve(_maxBatch);
+    std::unique_lock<std::mutex> lock(_mutex);
+    while(true)
+    {
+        _condition.wait(lock, [this]()->bool{ return _stop || !_queue.empty(); });
+        if(_queue.empty())
+            return;
+        //waits for more requests until the budget of the oldest one is spent
+        std::chrono::steady_clock::time_point deadline = _queue.front().submitted + _budget;
+        _condition.wait_until(lock, deadline, [this]()->bool{ return _stop || _queue.size() >= _maxBatch; });
+
+        size_t count = std::min(_queue.size(), _maxBatch);
+        for(size_t i = 0; i < count; i++)
+        {
+            batch.push_back(std::move(_queue.front()));
+            _queue.pop_front();
+        }
+        lock.unlock();
+        processBatch(batch);
+        batch.clear();
+        lock.lock();
+    }
+}
+
+
+//an error of the network is given to all the requests of the batch.
+//The statistics are recorded before the results are given, a caller having all its results sees them in stats()
+void omnilearn::InferenceEngine::processBatch(std::vector<Request>& batch)
+{
+    Matrix inputs(static_cast<eigen_size_t>(batch.size()), static_cast<eigen_size_t>(_inputSize));
+    for(size_t i = 0; i < batch.size(); i++)
+        inputs.row(static_cast<eigen_size_t>(i)) = batch[i].input.transpose();
+    Matrix outputs;
+    std::exception_ptr error;
+    try
+    {
+        outputs = _network.process(std::move(inputs));
+    }
+    catch(...)
+    {
+        error = std::current_exception();
+    }
+
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    {
+        std::unique_lock<std::mutex> lock(_statsMutex);
+        for(size_t i = 0; i < batch.size(); i++)
+        {
+            double latency = std::chrono::duration<double, std::micro>(now - batch[i].submitted).count();
+            if(_latencies.size() < latencyWindow)
+                _latencies.push_back(latency);
+            else
+                _latencies[_requests % latencyWindow] = latency;
+            _requests++;
+        }
+        _batches++;
+    }
+
+    for(size_t i = 0; i < batch.size(); i++)
+    {
+        if(error)
+            batch[i].result.set_exception(error);
+        else
+            batch[i].result.set_value(outputs.row(static_cast<eigen_size_t>(i)).transpose());
+    }
+}
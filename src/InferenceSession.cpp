@@ -0,0 +1,148 @@
+// InferenceSession.cpp
+
+#include "omnilearn/InferenceSession.hh"
+
+
+
+omnilearn::InferenceSession::InferenceSession(Network const& network, size_t maxBatch):
+_network(network),
+_maxBatch(std::max(static_cast<size_t>(1), maxBatch)),
+_inputSize(network.inputSize()),
+_outputSize(network._layers.back().size()),
+_inputMap(),
+_inputScale(),
+_inputOffset(),
+_outputMap(),
+_outputOffset(),
+_inputs(),
+_buffers(),
+_workspace()
+{
+    eigen_size_t rows = static_cast<eigen_size_t>(_maxBatch);
+    eigen_size_t width = 0;
+    eigen_size_t sets = 0;
+    for(size_t i = 0; i < network._layers.size(); i++)
+    {
+        Layer const& layer = network._layers[i];
+        if(layer.getFunctions().first == Aggregation::Distance)
+            throw Exception("An inference session can't be used with distance aggregation.");
+        width = std::max(width, static_cast<eigen_size_t>(layer.size()));
+        if(static_cast<size_t>(layer.getWeights().rows()) != layer.size())
+            sets = std::max(sets, static_cast<eigen_size_t>(layer.getWeights().rows()));
+    }
+    if(!network._param.preprocessInputs.empty())
+    {
+        std::pair<Matrix, rowVector> map = network.inputMap();
+        bool diagonal = true;
+        for(Preprocess pre : network._param.preprocessInputs)
+            if(pre != Preprocess::Center && pre != Preprocess::Normalize && pre != Preprocess::Standardize)
+                diagonal = false;
+        if(diagonal)
+            _inputScale = map.first.diagonal().transpose();
+        else
+            _inputMap = map.first.transpose();
+        _inputOffset = map.second;
+        _inputs = Matrix(rows, map.first.cols());
+    }
+    if(!network._param.preprocessOutputs.empty())
+    {
+        std::pair<Matrix, rowVector> map = network.outputMap();
+        _outputMap = map.first.transpose();
+        _outputOffset = map.second;
+        _outputSize = static_cast<size_t>(_outputMap.rows());
+    }
+    _buffers[0] = Matrix(rows, width);
+    _buffers[1] = Matrix(rows, width);
+    _workspace = Matrix(rows, sets);
+}
+
+
+void omnilearn::InferenceSession::process(ConstView const& inputs, View outputs)
+{
+    if(static_cast<size_t>(inputs.cols()) != _inputSize || static_cast<size_t>(outputs.cols()) != _outputSize || inputs.rows() != outputs.rows())
+        throw Exception("The inputs must have " + std::to_string(_inputSize) + " columns and the outputs " + std::to_string(_outputSize) + ", for the same number of lines.");
+    eigen_size_t batch = static_cast<eigen_size_t>(_maxBatch);
+    for(eigen_size_t begin = 0; begin < inputs.rows(); begin += batch)
+    {
+        eigen_size_t count = std::min(batch, inputs.rows() - begin);
+        processBlock(ConstView(inputs.row(begin).data(), count, inputs.cols(), Eigen::OuterStride<>(inputs.outerStride())),
+                     View(outputs.row(begin).data(), count, outputs.cols(), Eigen::OuterStride<>(outputs.outerStride())));
+    }
+}
+
+
+void omnilearn::InferenceSession::process(double const* inputs, size_t rows, size_t stride, double* outputs, size_t outputStride)
+{
+    eigen_size_t lines = static_cast<eigen_size_t>(rows);
+    process(ConstView(inputs, lines, static_cast<eigen_size_t>(_inputSize), Eigen::OuterStride<>(static_cast<eigen_size_t>(stride))),
+            View(outputs, lines, static_cast<eigen_size_t>(_outputSize), Eigen::OuterStride<>(static_cast<eigen_size_t>(outputStride))));
+}
+
+
+size_t omnilearn::InferenceSession::inputSize() const
+{
+    return _inputSize;
+}
+
+
+size_t omnilearn::InferenceSession::outputSize() const
+{
+    return _outputSize;
+}
+
+
+//a 256kB L2 cache is assumed, holding for each line the raw and preprocessed inputs, both activation buffers and the maxout workspace
+size_t omnilearn::InferenceSession::blockRows(Network const& network)
+{
+    size_t width = 0;
+    size_t sets = 0;
+    for(size_t i = 0; i < network._layers.size(); i++)
+    {
+        width = std::max(width, network._layers[i].size());
+        if(static_cast<size_t>(network._layers[i].getWeights().rows()) != network._layers[i].size())
+            sets = std::max(sets, static_cast<size_t>(network._layers[i].getWeights().rows()));
+    }
+    size_t line = network.inputSize() + 2 * width + sets;
+    if(!network._param.preprocessInputs.empty())
+        line += static_cast<size_t>(network._layers[0].getWeights().cols());
+    return std::max(static_cast<size_t>(8), static_cast<size_t>(32768) / line);
+}
+
+
+//the last layer writes directly in the outputs when they don't have to be restored
+void omnilearn::InferenceSession::processBlock(ConstView const& inputs, View outputs)
+{
+    std::vector<Layer> const& layers = _network._layers;
+    eigen_size_t rows = inputs.rows();
+    if(_inputScale.size() != 0)
+    {
+        _inputs.topRows(rows).array() = (inputs.array().rowwise() * _inputScale.array()).rowwise() + _inputOffset.array();
+    }
+    else if(_inputMap.size() != 0)
+    {
+        multiplyTransposed(inputs, _inputMap, _inputs.topRows(rows));
+        _inputs.topRows(rows).rowwise() += _inputOffset;
+    }
+
+    for(size_t i = 0; i < layers.size(); i++)
+    {
+        eigen_size_t size = static_cast<eigen_size_t>(layers[i].size());
+        bool direct = (i == layers.size() - 1 && _outputMap.size() == 0);
+        View output(direct ? outputs.data() : _buffers[i % 2].data(), rows, size,
+                    Eigen::OuterStride<>(direct ? outputs.outerStride() : _buffers[i % 2].outerStride()));
+        if(i > 0)
+            layers[i].process(_buffers[(i-1) % 2].topLeftCorner(rows, static_cast<eigen_size_t>(layers[i-1].size())), output, _workspace);
+        else if(_inputs.size() != 0)
+            layers[i].process(_inputs.topRows(rows), output, _workspace);
+        else
+            layers[i].process(inputs, output, _workspace);
+        if(i == layers.size() - 1 && _network._param.loss == Loss::CrossEntropy)
+            softmaxInPlace(output);
+    }
+
+    if(_outputMap.size() != 0)
+    {
+        multiplyTransposed(_buffers[(layers.size()-1) % 2].topLeftCorner(rows, static_cast<eigen_size_t>(layers.back().size())), _outputMap, outputs);
+        outputs.rowwise() += _outputOffset;
+    }
+}
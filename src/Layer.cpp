@@ -7,76 +7,152 @@
 omnilearn::Layer::Layer(LayerParam const& param, size_t aggregation, size_t activation):
 _param(param),
 _inputSize(0),
-_neurons(std::vector<Neuron>(param.size, Neuron(aggregation, activation))),
-_aggrAct({aggregation, activation})
+_aggrAct({aggregation, activation}),
+_aggregation(aggregationMap[aggregation]()),
+_activation(activationMap[activation]()),
+_kernel(kernelMap.count(_aggrAct) ? kernelMap[_aggrAct]() : nullptr),
+_arena(),
+_sharedParameters(nullptr),
+_weightsetCount(),
+_iteration(0),
+_batchInputs(),
+_batchSparseInputs(),
+_batchActivations(),
+_batchDropout(),
+_batchWeights(),
+_batchDropconnect(),
+_batchSets(),
+_batchDeltas()
 {
 }
 
 
 void omnilearn::Layer::init(size_t nbInputs, size_t nbOutputs, std::mt19937& generator)
 {
-    _inputSize = nbInputs;
-    for(size_t i = 0; i < _neurons.size(); i++)
+    if(_aggrAct.first == Aggregation::Maxout ? _param.k < 2 : _param.k != 1)
+        throw Exception("Maxout aggregation requires multiple weight sets, other aggregations require only one.");
+
+    allocate(nbInputs);
+    Eigen::Map<Matrix> weights = weightTensor(Tensor::Parameters);
+
+    if(_param.distrib == Distrib::Normal)
     {
-        _neurons[i].init(_param.distrib, _param.mean_boundary, _param.deviation, nbInputs, nbOutputs, _param.k, generator, _param.useOutput);
+        double deviation = std::sqrt(_param.deviation / static_cast<double>(nbInputs + (_param.useOutput ? nbOutputs : 0)));
+        std::normal_distribution<double> normalDist(_param.mean_boundary, deviation);
+        for(eigen_size_t i = 0; i < weights.rows(); i++)
+            for(eigen_size_t j = 0; j < weights.cols(); j++)
+                weights(i, j) = normalDist(generator);
+    }
+    else if(_param.distrib == Distrib::Uniform)
+    {
+        double boundary = std::sqrt(_param.deviation / static_cast<double>(nbInputs + (_param.useOutput ? nbOutputs : 0)));
+        std::uniform_real_distribution<double> uniformDist(-boundary, boundary);
+        for(eigen_size_t i = 0; i < weights.rows(); i++)
+            for(eigen_size_t j = 0; j < weights.cols(); j++)
+                weights(i, j) = uniformDist(generator);
     }
 }
 
 
 void omnilearn::Layer::init(size_t nbInputs)
 {
-    _inputSize = nbInputs;
+    if(nbInputs != _inputSize)
+        allocate(nbInputs);
 }
 
 
 omnilearn::Matrix omnilearn::Layer::process(Matrix const& inputs, ThreadPool& t) const
 {
     //lines are features, columns are neurons
-    Matrix output(inputs.rows(), _neurons.size());
-    std::vector<std::future<void>> tasks(_neurons.size());
+    std::vector<size_t> sets;
+    return forward(inputs, weightTensor(Tensor::Parameters), sets, t);
+}
 
-    for(size_t i = 0; i < _neurons.size(); i++)
+
+omnilearn::Matrix omnilearn::Layer::process(SparseMatrix const& inputs, ThreadPool& t) const
+{
+    std::vector<size_t> sets;
+    return forward(inputs, weightTensor(Tensor::Parameters), sets, t);
+}
+
+
+void omnilearn::Layer::process(Eigen::Ref<Matrix const> const& inputs, Eigen::Ref<Matrix> output, Eigen::Ref<Matrix> workspace) const
+{
+    if(_aggrAct.first == Aggregation::Distance)
+        throw Exception("Distance aggregation can't be processed without allocation.");
+    eigen_size_t k = static_cast<eigen_size_t>(_param.k);
+    Eigen::Map<Matrix const> weights = weightTensor(Tensor::Parameters);
+    Eigen::Map<Vector const> bias = biasTensor(Tensor::Parameters);
+    if(k == 1)
     {
-        tasks[i] = t.enqueue([this, &inputs, &output, i]()->void
-        {
-            //one result per feature (for each neuron)
-            Vector result = _neurons[i].process(inputs);
-            for(eigen_size_t j = 0; j < result.size(); j++)
-                output(j, i) = result[j];
-        });
+        multiplyTransposed(inputs, weights, view(output));
+        output.rowwise() += bias.transpose();
     }
-    for(size_t i = 0; i < tasks.size(); i++)
+    else
     {
-        tasks[i].get();
+        Eigen::Ref<Matrix> aggregated = workspace.topLeftCorner(inputs.rows(), weights.rows());
+        multiplyTransposed(inputs, weights, view(aggregated));
+        aggregated.rowwise() += bias.transpose();
+        for(eigen_size_t j = 0; j < inputs.rows(); j++)
+            for(eigen_size_t i = 0; i < output.cols(); i++)
+                output(j, i) = aggregated.row(j).segment(i*k, k).maxCoeff();
     }
-    return output;
+    _activation->activate(view(output));
 }
 
 
 omnilearn::Vector omnilearn::Layer::processToLearn(Vector const& input, double dropout, double dropconnect, std::bernoulli_distribution& dropoutDist, std::bernoulli_distribution& dropconnectDist, std::mt19937& dropGen, ThreadPool& t)
 {
     //each element is associated to a neuron
-    Vector output(_neurons.size());
-    std::vector<std::future<void>> tasks(_neurons.size());
+    return processToLearn(Matrix(input.transpose()), dropout, dropconnect, dropoutDist, dropconnectDist, dropGen, t).row(0).transpose();
+}
+
+
+//lines are features of the batch, columns are neurons
+omnilearn::Matrix omnilearn::Layer::processToLearn(Matrix const& inputs, double dropout, double dropconnect, std::bernoulli_distribution& dropoutDist, std::bernoulli_distribution& dropconnectDist, std::mt19937& dropGen, ThreadPool& t)
+{
+    _batchInputs = inputs;
+    _batchSparseInputs = SparseMatrix();
+    return forwardToLearn(inputs, dropout, dropconnect, dropoutDist, dropconnectDist, dropGen, t);
+}
 
-    for(size_t i = 0; i < _neurons.size(); i++)
+
+omnilearn::Matrix omnilearn::Layer::processToLearn(SparseMatrix const& inputs, double dropout, double dropconnect, std::bernoulli_distribution& dropoutDist, std::bernoulli_distribution& dropconnectDist, std::mt19937& dropGen, ThreadPool& t)
+{
+    _batchInputs = Matrix(0, 0);
+    _batchSparseInputs = inputs;
+    return forwardToLearn(inputs, dropout, dropconnect, dropoutDist, dropconnectDist, dropGen, t);
+}
+
+
+//forward pass of a batch with dropconnect and dropout, the masks are kept for the gradients
+template<typename Inputs>
+omnilearn::Matrix omnilearn::Layer::forwardToLearn(Inputs const& inputs, double dropout, double dropconnect, std::bernoulli_distribution& dropoutDist, std::bernoulli_distribution& dropconnectDist, std::mt19937& dropGen, ThreadPool& t)
+{
+    //dropConnect (one mask for the whole batch)
+    _batchDropconnect = Matrix(0, 0);
+    if(dropconnect > std::numeric_limits<double>::epsilon())
     {
-        tasks[i] = t.enqueue([this, &input, &output, i, dropout, dropconnect, &dropoutDist, &dropconnectDist, &dropGen]()->void
-        {
-            output(i) = _neurons[i].processToLearn(input, dropconnect, dropconnectDist, dropGen);
-            //dropOut
-            if(dropout > std::numeric_limits<double>::epsilon())
-            {
-                if(dropoutDist(dropGen))
-                    output[i] = 0;
-                else
-                    output[i] /= (1-dropout);
-            }
-        });
+        Eigen::Map<Matrix const> weights = getWeights();
+        _batchDropconnect = Matrix(weights.rows(), weights.cols());
+        for(eigen_size_t i = 0; i < _batchDropconnect.rows(); i++)
+            for(eigen_size_t j = 0; j < _batchDropconnect.cols(); j++)
+                _batchDropconnect(i, j) = (dropconnectDist(dropGen) ? 0 : 1 / (1 - dropconnect));
+        _batchWeights = weights.array() * _batchDropconnect.array();
     }
-    for(size_t i = 0; i < tasks.size(); i++)
+
+    _batchActivations = forward(inputs, batchWeights(), _batchSets, t);
+    Matrix output = _batchActivations;
+
+    //dropOut
+    _batchDropout = Matrix(0, 0);
+    if(dropout > std::numeric_limits<double>::epsilon())
     {
-        tasks[i].get();
+        _batchDropout = Matrix(output.rows(), output.cols());
+        for(eigen_size_t i = 0; i < _batchDropout.rows(); i++)
+            for(eigen_size_t j = 0; j < _batchDropout.cols(); j++)
+                _batchDropout(i, j) = (dropoutDist(dropGen) ? 0 : 1 / (1 - dropout));
+        output.array() *= _batchDropout.array();
     }
     return output;
 }
@@ -84,19 +160,107 @@ omnilearn::Vector omnilearn::Layer::processToLearn(Vector const& input, double d
 
 void omnilearn::Layer::computeGradients(Vector const& inputGradient, ThreadPool& t)
 {
-    std::vector<std::future<void>> tasks(_neurons.size());
+    computeGradients(Matrix(inputGradient.transpose()), t);
+}
+
+
+//one line of gradients per feature of the batch, summed over the batch
+void omnilearn::Layer::computeGradients(Matrix const& inputGradients, ThreadPool& t)
+{
+    eigen_size_t nbNeurons = static_cast<eigen_size_t>(_param.size);
+    eigen_size_t k = static_cast<eigen_size_t>(_param.k);
 
-    for(size_t i = 0; i < _neurons.size(); i++)
+    //gradient on the aggregation result, only the used weight set receives it
+    _batchDeltas = Matrix::Constant(inputGradients.rows(), nbNeurons * k, 0);
+    rowVector coefs = (_kernel ? _activation->getCoefs() : rowVector());
+    forEachBlock(inputGradients.rows(), ThreadPool::grain(_param.size * _param.k), t, [this, &inputGradients, &coefs, nbNeurons, k](eigen_size_t begin, eigen_size_t count)->void
     {
-        tasks[i] = t.enqueue([this, &inputGradient, i]()->void
+        Matrix gradients = _batchActivations.middleRows(begin, count);
+        if(_kernel)
+            _kernel->prime(gradients, coefs);
+        else
+            _activation->prime(gradients);
+        gradients.array() *= inputGradients.middleRows(begin, count).array();
+        if(_batchDropout.size() != 0)
+            gradients.array() *= _batchDropout.middleRows(begin, count).array();
+
+        if(k == 1)
         {
-            _neurons[i].computeGradients(inputGradient[i]);
+            _batchDeltas.middleRows(begin, count) = gradients;
+            return;
+        }
+        for(eigen_size_t j = 0; j < count; j++)
+            for(eigen_size_t i = 0; i < nbNeurons; i++)
+                _batchDeltas(begin + j, i*k + static_cast<eigen_size_t>(_batchSets[(begin + j)*nbNeurons + i])) = gradients(j, i);
+    });
+
+    biasTensor(Tensor::Gradients) += _batchDeltas.colwise().sum().transpose();
+    for(eigen_size_t j = 0; j < _batchDeltas.rows(); j++)
+        for(eigen_size_t i = 0; i < nbNeurons; i++)
+            _weightsetCount[i*k + _batchSets[j*nbNeurons + i]]++;
+
+    //only the columns of the non-zero inputs receive a gradient
+    if(_batchSparseInputs.rows() != 0)
+    {
+        accumulateSparseGradients(t);
+        return;
+    }
+
+    Eigen::Map<Matrix const> weights = batchWeights();
+    Matrix gradients(nbNeurons * k, _batchInputs.cols());
+
+    if(_aggrAct.first == Aggregation::Distance)
+    {
+        forEachBlock(nbNeurons, ThreadPool::grain(static_cast<size_t>(_batchInputs.size()) * _param.k), t, [this, &gradients, &weights, nbNeurons, k](eigen_size_t begin, eigen_size_t count)->void
+        {
+            for(eigen_size_t i = begin; i < begin + count; i++)
+            {
+                gradients.middleRows(i*k, k).setZero();
+                for(eigen_size_t j = 0; j < _batchInputs.rows(); j++)
+                {
+                    eigen_size_t set = i*k + static_cast<eigen_size_t>(_batchSets[j*nbNeurons + i]);
+                    gradients.row(set) += _batchDeltas(j, set) * _aggregation->prime(_batchInputs.row(j), weights.row(set)).transpose();
+                }
+            }
         });
     }
-    for(size_t i = 0; i < tasks.size(); i++)
+    else
     {
-        tasks[i].get();
+        //dot and maxout: the sum over the batch is one GEMM
+        forEachBlock(gradients.rows(), ThreadPool::grain(static_cast<size_t>(_batchInputs.size())), t, [this, &gradients](eigen_size_t begin, eigen_size_t count)->void
+        {
+            gradients.middleRows(begin, count).noalias() = _batchDeltas.middleCols(begin, count).transpose() * _batchInputs;
+        });
     }
+    if(_batchDropconnect.size() != 0)
+        gradients.array() *= _batchDropconnect.array();
+
+    weightTensor(Tensor::Gradients) += gradients;
+}
+
+
+//adds the gradients of a sparse batch to the Gradients tensor, only on the columns of its non-zero inputs
+void omnilearn::Layer::accumulateSparseGradients(ThreadPool& t)
+{
+    Eigen::Map<Matrix> gradients = weightTensor(Tensor::Gradients);
+    bool dropconnect = (_batchDropconnect.size() != 0);
+
+    //each weight set is a line of the tensor, the sum over the batch is done in place
+    forEachBlock(gradients.rows(), ThreadPool::grain(static_cast<size_t>(_batchSparseInputs.nonZeros())), t, [this, &gradients, dropconnect](eigen_size_t begin, eigen_size_t count)->void
+    {
+        for(eigen_size_t i = begin; i < begin + count; i++)
+        {
+            for(eigen_size_t j = 0; j < _batchSparseInputs.rows(); j++)
+            {
+                //weight sets not used by maxout for this feature have no delta
+                double delta = _batchDeltas(j, i);
+                if(!(std::abs(delta) > 0))
+                    continue;
+                for(SparseMatrix::InnerIterator it(_batchSparseInputs, j); it; ++it)
+                    gradients(i, it.col()) += delta * it.value() * (dropconnect ? _batchDropconnect(i, it.col()) : 1);
+            }
+        }
+    });
 }
 
 
@@ -108,106 +272,483 @@ void omnilearn::Layer::computeGradientsAccordingToInputs(Vector const& inputGrad
 
 void omnilearn::Layer::save()
 {
-    for(size_t i = 0; i < _neurons.size(); i++)
-    {
-        _neurons[i].save();
-    }
+    size_t size = tensorSize();
+    _arena.segment(static_cast<eigen_size_t>(Tensor::Saved) * size, size) = _arena.segment(static_cast<eigen_size_t>(Tensor::Parameters) * size, size);
+    _aggregation->save();
+    _activation->save();
 }
 
 
 void omnilearn::Layer::loadSaved()
 {
-    for(size_t i = 0; i < _neurons.size(); i++)
+    size_t size = tensorSize();
+    _arena.segment(static_cast<eigen_size_t>(Tensor::Parameters) * size, size) = _arena.segment(static_cast<eigen_size_t>(Tensor::Saved) * size, size);
+    _aggregation->loadSaved();
+    _activation->loadSaved();
+}
+
+
+void omnilearn::Layer::shareParameters(Layer const* layer)
+{
+    _sharedParameters = layer;
+}
+
+
+void omnilearn::Layer::mergeGradients(Layer& replica)
+{
+    size_t size = tensorSize();
+    _arena.segment(static_cast<eigen_size_t>(Tensor::Gradients) * size, size) += replica._arena.segment(static_cast<eigen_size_t>(Tensor::Gradients) * size, size);
+    replica._arena.segment(static_cast<eigen_size_t>(Tensor::Gradients) * size, size).setZero();
+    for(size_t i = 0; i < _weightsetCount.size(); i++)
     {
-        _neurons[i].loadSaved();
+        _weightsetCount[i] += replica._weightsetCount[i];
+        replica._weightsetCount[i] = 0;
     }
 }
 
 
+//the pulled parameters are kept in the Saved tensor, replicas never save
+void omnilearn::Layer::pullParameters(Layer const& layer)
+{
+    size_t size = tensorSize();
+    _arena.segment(static_cast<eigen_size_t>(Tensor::Parameters) * size, size) = layer._arena.segment(static_cast<eigen_size_t>(Tensor::Parameters) * size, size);
+    _arena.segment(static_cast<eigen_size_t>(Tensor::Saved) * size, size) = _arena.segment(static_cast<eigen_size_t>(Tensor::Parameters) * size, size);
+}
+
+
+void omnilearn::Layer::pushParameters(Layer& layer) const
+{
+    size_t size = tensorSize();
+    double* target = layer._arena.data() + static_cast<size_t>(Tensor::Parameters) * size;
+    double const* current = _arena.data() + static_cast<size_t>(Tensor::Parameters) * size;
+    double const* pulled = _arena.data() + static_cast<size_t>(Tensor::Saved) * size;
+    for(size_t i = 0; i < size; i++)
+        target[i] += current[i] - pulled[i];
+}
+
+
 //one gradient per input neuron
-omnilearn::Vector omnilearn::Layer::getGradients(ThreadPool& t)
+omnilearn::Vector omnilearn::Layer::getGradients(ThreadPool& t) const
 {
-    Vector grad = Vector::Constant(_inputSize, 0);
-    std::vector<std::future<void>> tasks(_neurons.size());
+    Eigen::Map<Matrix const> weights = batchWeights();
+
+    //only the weight set used by each neuron has a non-zero delta
+    if(_aggrAct.first != Aggregation::Distance)
+        return weights.transpose() * _batchDeltas.row(0).transpose();
 
-    for(size_t i = 0; i < _neurons.size(); i++)
+    //partial sums over chunks of weight sets, combined in chunk order
+    return t.parallel_reduce(0, static_cast<size_t>(weights.rows()), ThreadPool::grain(_inputSize), Vector(Vector::Constant(_inputSize, 0)), [this, &weights](size_t begin, size_t end)->Vector
     {
-        tasks[i] = t.enqueue([this, i, &grad]()->void
+        Vector partial = Vector::Constant(_inputSize, 0);
+        for(eigen_size_t i = static_cast<eigen_size_t>(begin); i < static_cast<eigen_size_t>(end); i++)
         {
-            Vector neuronGrad = _neurons[i].getGradients();
-            for(eigen_size_t j = 0; j < neuronGrad.size(); j++)
-                grad(j) += neuronGrad(j);
-        });
-    }
-    for(size_t i = 0; i < tasks.size(); i++)
-        tasks[i].get();
-    return grad;
+            if(std::abs(_batchDeltas(0, i)) > 0)
+                partial += _batchDeltas(0, i) * _aggregation->primeInput(_batchInputs.row(0), weights.row(i));
+        }
+        return partial;
+    }, [](Vector const& a, Vector const& b)->Vector {return a + b;});
 }
 
 
-void omnilearn::Layer::updateWeights(double learningRate, double L1, double L2, Optimizer opti, double momentum, double window, double optimizerBias, ThreadPool& t)
+//one gradient per input neuron, for each feature of the batch
+omnilearn::Matrix omnilearn::Layer::getBatchGradients(ThreadPool& t) const
 {
-    std::vector<std::future<void>> tasks(_neurons.size());
+    Eigen::Map<Matrix const> weights = batchWeights();
+    Matrix gradients(_batchDeltas.rows(), _batchInputs.cols());
 
-    for(size_t i = 0; i < _neurons.size(); i++)
+    if(_aggrAct.first == Aggregation::Distance)
     {
-        tasks[i] = t.enqueue([=]()->void
+        forEachBlock(gradients.rows(), ThreadPool::grain(static_cast<size_t>(weights.size())), t, [this, &gradients, &weights](eigen_size_t begin, eigen_size_t count)->void
         {
-            _neurons[i].updateWeights(learningRate, L1, L2, _param.maxNorm, opti, momentum, window, optimizerBias);
+            for(eigen_size_t j = begin; j < begin + count; j++)
+            {
+                gradients.row(j).setZero();
+                for(eigen_size_t i = 0; i < _batchDeltas.cols(); i++)
+                {
+                    if(std::abs(_batchDeltas(j, i)) > 0)
+                        gradients.row(j) += _batchDeltas(j, i) * _aggregation->primeInput(_batchInputs.row(j), weights.row(i)).transpose();
+                }
+            }
         });
     }
-    for(size_t i = 0; i < tasks.size(); i++)
+    else
     {
-        tasks[i].get();
+        forEachBlock(gradients.rows(), ThreadPool::grain(static_cast<size_t>(weights.size())), t, [this, &gradients, &weights](eigen_size_t begin, eigen_size_t count)->void
+        {
+            gradients.middleRows(begin, count).noalias() = _batchDeltas.middleRows(begin, count) * weights;
+        });
     }
+    return gradients;
+}
+
+
+void omnilearn::Layer::updateWeights(double learningRate, double L1, double L2, Optimizer opti, double momentum, double window, double optimizerBias, ThreadPool& t)
+{
+    _iteration++;
+    if(opti == Optimizer::None)
+        applyUpdate(optimizer::None(learningRate, momentum, window, optimizerBias, _iteration), learningRate, L1, L2, t);
+    else if(opti == Optimizer::Momentum || opti == Optimizer::Nesterov)
+        applyUpdate(optimizer::Momentum(learningRate, momentum, window, optimizerBias, _iteration), learningRate, L1, L2, t);
+    else if(opti == Optimizer::Adagrad)
+        applyUpdate(optimizer::Adagrad(learningRate, momentum, window, optimizerBias, _iteration), learningRate, L1, L2, t);
+    else if(opti == Optimizer::Rmsprop)
+        applyUpdate(optimizer::Rmsprop(learningRate, momentum, window, optimizerBias, _iteration), learningRate, L1, L2, t);
+    else if(opti == Optimizer::Adam)
+        applyUpdate(optimizer::Adam(learningRate, momentum, window, optimizerBias, _iteration), learningRate, L1, L2, t);
+    else if(opti == Optimizer::Adamax)
+        applyUpdate(optimizer::Adamax(learningRate, momentum, window, optimizerBias, _iteration), learningRate, L1, L2, t);
+    else if(opti == Optimizer::Nadam)
+        applyUpdate(optimizer::Nadam(learningRate, momentum, window, optimizerBias, _iteration), learningRate, L1, L2, t);
+    else if(opti == Optimizer::AmsGrad)
+        applyUpdate(optimizer::AmsGrad(learningRate, momentum, window, optimizerBias, _iteration), learningRate, L1, L2, t);
 }
 
 
 size_t omnilearn::Layer::size() const
 {
-    return _neurons.size();
+    return _param.size;
+}
+
+
+//one line per weight set (neuron i owns lines i*k to i*k+k-1)
+Eigen::Map<omnilearn::Matrix const> omnilearn::Layer::getWeights() const
+{
+    return weightTensor(Tensor::Parameters);
 }
 
 
-std::vector<std::pair<omnilearn::Matrix, omnilearn::Vector>> omnilearn::Layer::getWeights(ThreadPool& t) const
+Eigen::Map<omnilearn::Vector const> omnilearn::Layer::getBias() const
 {
-    std::vector<std::pair<Matrix, Vector>> weights(size());
-    std::vector<std::future<void>> tasks(_neurons.size());
+    return biasTensor(Tensor::Parameters);
+}
+
 
-    for(size_t i = 0; i < _neurons.size(); i++)
+void omnilearn::Layer::resize(size_t neurons)
+{
+    _param.size = neurons;
+    _inputSize = 0;
+    _arena = Vector(0);
+    _weightsetCount.clear();
+}
+
+
+std::vector<omnilearn::rowVector> omnilearn::Layer::getCoefs() const
+{
+    std::vector<rowVector> coefs(_param.size + 1);
+    coefs[0] = (rowVector(2) << static_cast<double>(_aggregation->id()), static_cast<double>(_activation->id())).finished();
+
+    rowVector aggreg(_aggregation->getCoefs());
+    rowVector activ(_activation->getCoefs());
+    eigen_size_t k = static_cast<eigen_size_t>(_param.k);
+    eigen_size_t nbWeights = k * static_cast<eigen_size_t>(_inputSize);
+    Eigen::Map<Vector const> bias = biasTensor(Tensor::Parameters);
+
+    for(size_t i = 0; i < _param.size; i++)
     {
-        tasks[i] = t.enqueue([this, &weights, i]()->void
+        //weight sets of a neuron are contiguous
+        Eigen::Map<rowVector const> weights(weightTensor(Tensor::Parameters).data() + static_cast<eigen_size_t>(i) * nbWeights, nbWeights);
+        coefs[i+1] = (rowVector(aggreg.size() + activ.size() + k + nbWeights + 4) <<
+                      static_cast<double>(aggreg.size()), aggreg, static_cast<double>(activ.size()), activ, static_cast<double>(k), bias.segment(static_cast<eigen_size_t>(i)*k, k).transpose(), static_cast<double>(nbWeights), weights).finished();
+    }
+    return coefs;
+}
+
+
+void omnilearn::Layer::setCoefs(size_t neuron, Matrix const& weights, Vector const& bias, Vector const& aggreg, Vector const& activ)
+{
+    if(static_cast<size_t>(weights.rows()) != _param.k || static_cast<size_t>(weights.cols()) != _inputSize)
+    {
+        _param.k = static_cast<size_t>(weights.rows());
+        allocate(static_cast<size_t>(weights.cols()));
+    }
+    _aggregation->setCoefs(aggreg);
+    _activation->setCoefs(activ);
+    weightTensor(Tensor::Parameters).middleRows(static_cast<eigen_size_t>(neuron * _param.k), weights.rows()) = weights;
+    biasTensor(Tensor::Parameters).segment(static_cast<eigen_size_t>(neuron * _param.k), bias.size()) = bias;
+}
+
+
+std::pair<size_t, size_t> omnilearn::Layer::getFunctions() const
+{
+    return _aggrAct;
+}
+
+
+std::pair<omnilearn::rowVector, omnilearn::rowVector> omnilearn::Layer::getFunctionCoefs() const
+{
+    return {_aggregation->getCoefs(), _activation->getCoefs()};
+}
+
+
+//weights then bias of all the weight sets, contiguous (as in the parameter arena)
+Eigen::Map<omnilearn::Vector const> omnilearn::Layer::getParameters() const
+{
+    return Eigen::Map<Vector const>(tensorData(Tensor::Parameters), _param.size * _param.k * (_inputSize + 1));
+}
+
+
+Eigen::Map<omnilearn::Vector const> omnilearn::Layer::getSavedParameters() const
+{
+    return Eigen::Map<Vector const>(_arena.data() + static_cast<size_t>(Tensor::Saved) * tensorSize(), _param.size * _param.k * (_inputSize + 1));
+}
+
+
+void omnilearn::Layer::setParameters(Eigen::Ref<Vector const> const& parameters, Vector const& aggreg, Vector const& activ)
+{
+    if(static_cast<size_t>(parameters.size()) != _param.size * _param.k * (_inputSize + 1))
+        throw Exception("The number of parameters does not match the shape of the layer.");
+    _arena.segment(static_cast<eigen_size_t>(Tensor::Parameters) * tensorSize(), parameters.size()) = parameters;
+    _aggregation->setCoefs(aggreg);
+    _activation->setCoefs(activ);
+}
+
+
+//all the tensors (parameters, optimizer moments, saved parameters) and the number of updates, for checkpoints
+Eigen::Map<omnilearn::Vector const> omnilearn::Layer::getArena() const
+{
+    return Eigen::Map<Vector const>(_arena.data(), _arena.size());
+}
+
+
+size_t omnilearn::Layer::getIteration() const
+{
+    return _iteration;
+}
+
+
+void omnilearn::Layer::setArena(Eigen::Ref<Vector const> const& arena, size_t iteration)
+{
+    if(arena.size() != _arena.size())
+        throw Exception("The size of the arena does not match the shape of the layer.");
+    _arena = arena;
+    _iteration = iteration;
+}
+
+
+void omnilearn::Layer::allocate(size_t nbInputs)
+{
+    _inputSize = nbInputs;
+    _arena = Vector::Constant(static_cast<eigen_size_t>(static_cast<size_t>(Tensor::Count) * tensorSize()), 0);
+    _weightsetCount = std::vector<size_t>(_param.size * _param.k, 0);
+    _iteration = 0;
+}
+
+
+//each tensor is padded to keep the following one on a cache line boundary
+size_t omnilearn::Layer::tensorSize() const
+{
+    size_t size = _param.size * _param.k * (_inputSize + 1);
+    return (size + 7) / 8 * 8;
+}
+
+
+Eigen::Map<omnilearn::Matrix> omnilearn::Layer::weightTensor(Tensor tensor)
+{
+    return Eigen::Map<Matrix>(_arena.data() + static_cast<size_t>(tensor) * tensorSize(), _param.size * _param.k, _inputSize);
+}
+
+
+Eigen::Map<omnilearn::Matrix const> omnilearn::Layer::weightTensor(Tensor tensor) const
+{
+    return Eigen::Map<Matrix const>(tensorData(tensor), _param.size * _param.k, _inputSize);
+}
+
+
+Eigen::Map<omnilearn::Vector> omnilearn::Layer::biasTensor(Tensor tensor)
+{
+    return Eigen::Map<Vector>(_arena.data() + static_cast<size_t>(tensor) * tensorSize() + _param.size * _param.k * _inputSize, _param.size * _param.k);
+}
+
+
+Eigen::Map<omnilearn::Vector const> omnilearn::Layer::biasTensor(Tensor tensor) const
+{
+    return Eigen::Map<Vector const>(tensorData(tensor) + _param.size * _param.k * _inputSize, _param.size * _param.k);
+}
+
+
+double const* omnilearn::Layer::tensorData(Tensor tensor) const
+{
+    if(tensor == Tensor::Parameters && _sharedParameters != nullptr)
+        return _sharedParameters->tensorData(tensor);
+    return _arena.data() + static_cast<size_t>(tensor) * tensorSize();
+}
+
+
+//weights used by the current batch (dropconnect applied)
+Eigen::Map<omnilearn::Matrix const> omnilearn::Layer::batchWeights() const
+{
+    if(_batchDropconnect.size() == 0)
+        return weightTensor(Tensor::Parameters);
+    return Eigen::Map<Matrix const>(_batchWeights.data(), _batchWeights.rows(), _batchWeights.cols());
+}
+
+
+//averages the gradients, applies the rule, the regularization and the max norm constraint in one sweep per weight set
+template<typename Rule>
+void omnilearn::Layer::applyUpdate(Rule const& rule, double learningRate, double L1, double L2, ThreadPool& t)
+{
+    Eigen::Map<Matrix> weights = weightTensor(Tensor::Parameters);
+    Eigen::Map<Vector> bias = biasTensor(Tensor::Parameters);
+    Eigen::Map<Matrix> gradients = weightTensor(Tensor::Gradients);
+    Eigen::Map<Vector> biasGradients = biasTensor(Tensor::Gradients);
+    Eigen::Map<Matrix> first = weightTensor(Tensor::FirstMoment);
+    Eigen::Map<Vector> biasFirst = biasTensor(Tensor::FirstMoment);
+    Eigen::Map<Matrix> second = weightTensor(Tensor::SecondMoment);
+    Eigen::Map<Vector> biasSecond = biasTensor(Tensor::SecondMoment);
+    Eigen::Map<Matrix> maxSecond = weightTensor(Tensor::MaxSecondMoment);
+    Eigen::Map<Vector> biasMaxSecond = biasTensor(Tensor::MaxSecondMoment);
+    double maxNorm = _param.maxNorm;
+
+    //each weight set is updated independently
+    forEachBlock(weights.rows(), ThreadPool::grain(_inputSize), t, [&](eigen_size_t begin, eigen_size_t count)->void
+    {
+        eigen_size_t cols = weights.cols();
+        for(eigen_size_t i = begin; i < begin + count; i++)
+        {
+            Eigen::Map<Vector> setWeights(weights.row(i).data(), cols);
+            Eigen::Map<Vector> step(gradients.row(i).data(), cols);
+            Eigen::Map<Vector> setFirst(first.row(i).data(), cols);
+            Eigen::Map<Vector> setSecond(second.row(i).data(), cols);
+            Eigen::Map<Vector> setMaxSecond(maxSecond.row(i).data(), cols);
+            Eigen::Map<Vector> biasStep(biasGradients.data() + i, 1);
+            Eigen::Map<Vector> setBiasFirst(biasFirst.data() + i, 1);
+            Eigen::Map<Vector> setBiasSecond(biasSecond.data() + i, 1);
+            Eigen::Map<Vector> setBiasMaxSecond(biasMaxSecond.data() + i, 1);
+
+            //average gradients over features
+            if(_weightsetCount[i] != 0)
+            {
+                step /= static_cast<double>(_weightsetCount[i]);
+                biasStep /= static_cast<double>(_weightsetCount[i]);
+            }
+
+            rule(step, setFirst, setSecond, setMaxSecond);
+            rule(biasStep, setBiasFirst, setBiasSecond, setBiasMaxSecond);
+
+            //the bias is not regularized
+            setWeights.array() += step.array() - learningRate * (L2 * setWeights.array() + L1 * (2 * (setWeights.array() > 0).cast<double>() - 1));
+            bias[i] += biasStep[0];
+
+            //max norm constraint
+            if(maxNorm > 0)
+            {
+                double norm = std::sqrt(setWeights.squaredNorm() + bias[i] * bias[i]);
+                if(norm > maxNorm)
+                {
+                    setWeights *= (maxNorm/norm);
+                    bias[i] *= (maxNorm/norm);
+                }
+            }
+
+            //reset gradients for the next batch
+            _weightsetCount[i] = 0;
+            step.setZero();
+            biasStep.setZero();
+        }
+    });
+}
+
+
+//aggregation and activation of each feature (lines) for each neuron (columns)
+//sets receives the weight set used by each neuron for each feature
+omnilearn::Matrix omnilearn::Layer::forward(Matrix const& inputs, Eigen::Map<Matrix const> const& weights, std::vector<size_t>& sets, ThreadPool& t) const
+{
+    eigen_size_t nbNeurons = static_cast<eigen_size_t>(_param.size);
+    eigen_size_t k = static_cast<eigen_size_t>(_param.k);
+    Eigen::Map<Vector const> bias = biasTensor(Tensor::Parameters);
+    Matrix output(inputs.rows(), nbNeurons);
+    sets = std::vector<size_t>(inputs.rows() * nbNeurons, 0);
+
+    if(_aggrAct.first == Aggregation::Distance)
+    {
+        forEachBlock(nbNeurons, ThreadPool::grain(static_cast<size_t>(inputs.size()) * _param.k), t, [this, &inputs, &weights, &bias, &output, &sets, nbNeurons, k](eigen_size_t begin, eigen_size_t count)->void
+        {
+            for(eigen_size_t i = begin; i < begin + count; i++)
+            {
+                Matrix neuronWeights = weights.middleRows(i*k, k);
+                Vector neuronBias = bias.segment(i*k, k);
+                for(eigen_size_t j = 0; j < inputs.rows(); j++)
+                {
+                    std::pair<double, size_t> aggregated = _aggregation->aggregate(inputs.row(j), neuronWeights, neuronBias);
+                    output(j, i) = aggregated.first;
+                    sets[j*nbNeurons + i] = aggregated.second;
+                }
+            }
+        });
+        forEachBlock(inputs.rows(), ThreadPool::grain(_param.size), t, [this, &output](eigen_size_t begin, eigen_size_t count)->void
         {
-            weights[i] = _neurons[i].getWeights();
+            _activation->activate(output.middleRows(begin, count));
         });
     }
-    for(size_t i = 0; i < tasks.size(); i++)
+    else if(_kernel)
     {
-        tasks[i].get();
+        //specialized kernel: aggregation and activation are known at compile time
+        rowVector coefs = _activation->getCoefs();
+        forEachBlock(inputs.rows(), ThreadPool::grain(static_cast<size_t>(weights.size())), t, [this, &inputs, &weights, &bias, &coefs, &output](eigen_size_t begin, eigen_size_t count)->void
+        {
+            _kernel->process(inputs.middleRows(begin, count), weights, bias, coefs, output.middleRows(begin, count));
+        });
     }
-        return weights;
+    else
+    {
+        dotForward(inputs, weights, output, sets, t);
+    }
+    return output;
 }
 
 
-void omnilearn::Layer::resize(size_t neurons)
+omnilearn::Matrix omnilearn::Layer::forward(SparseMatrix const& inputs, Eigen::Map<Matrix const> const& weights, std::vector<size_t>& sets, ThreadPool& t) const
 {
-    _neurons = std::vector<Neuron>(neurons, Neuron(_aggrAct.first, _aggrAct.second));
+    if(_aggrAct.first == Aggregation::Distance)
+        throw Exception("Sparse inputs can only be used with dot and maxout aggregations.");
+    Matrix output(inputs.rows(), static_cast<eigen_size_t>(_param.size));
+    sets = std::vector<size_t>(static_cast<size_t>(inputs.rows()) * _param.size, 0);
+    dotForward(inputs, weights, output, sets, t);
+    return output;
 }
 
 
-std::vector<omnilearn::rowVector> omnilearn::Layer::getCoefs() const
+//dot and maxout: one product gives the result of every weight set.
+//with sparse inputs, the cost depends on the non-zero inputs only
+template<typename Inputs>
+void omnilearn::Layer::dotForward(Inputs const& inputs, Eigen::Map<Matrix const> const& weights, Matrix& output, std::vector<size_t>& sets, ThreadPool& t) const
 {
-    std::vector<rowVector> coefs(_neurons.size() + 1);
-    coefs[0] = (rowVector(2) << static_cast<double>(aggregationMap[_aggrAct.first]()->id()), static_cast<double>(activationMap[_aggrAct.second]()->id())).finished();
-    for(size_t i = 0; i < _neurons.size(); i++)
+    eigen_size_t nbNeurons = static_cast<eigen_size_t>(_param.size);
+    eigen_size_t k = static_cast<eigen_size_t>(_param.k);
+    Eigen::Map<Vector const> bias = biasTensor(Tensor::Parameters);
+    size_t work = static_cast<size_t>(weights.rows()) * static_cast<size_t>(inputs.nonZeros()) / std::max<size_t>(1, static_cast<size_t>(inputs.rows()));
+
+    forEachBlock(inputs.rows(), ThreadPool::grain(work), t, [this, &inputs, &weights, &bias, &output, &sets, nbNeurons, k](eigen_size_t begin, eigen_size_t count)->void
     {
-        coefs[i+1] = _neurons[i].getCoefs();
-    }
-    return coefs;
+        if(k == 1)
+        {
+            output.middleRows(begin, count).noalias() = inputs.middleRows(begin, count) * weights.transpose();
+            output.middleRows(begin, count).rowwise() += bias.transpose();
+        }
+        else
+        {
+            Matrix aggregated = inputs.middleRows(begin, count) * weights.transpose();
+            aggregated.rowwise() += bias.transpose();
+            for(eigen_size_t j = 0; j < count; j++)
+            {
+                for(eigen_size_t i = 0; i < nbNeurons; i++)
+                {
+                    eigen_size_t set = 0;
+                    output(begin + j, i) = aggregated.row(j).segment(i*k, k).maxCoeff(&set);
+                    sets[(begin + j)*nbNeurons + i] = static_cast<size_t>(set);
+                }
+            }
+        }
+        _activation->activate(output.middleRows(begin, count));
+    });
 }
 
 
-void omnilearn::Layer::setCoefs(size_t neuron, Matrix const& weights, Vector const& bias, Vector const& aggreg, Vector const& activ)
+//calls func(begin, count) on chunks of [0, size), chunks are not smaller than grain
+void omnilearn::Layer::forEachBlock(eigen_size_t size, size_t grain, ThreadPool& t, std::function<void(eigen_size_t, eigen_size_t)> const& func)
 {
-    _neurons[neuron].setCoefs(weights, bias, aggreg, activ);
-}
\ No newline at end of file
+    t.parallel_for(0, static_cast<size_t>(size), grain, [&func](size_t begin, size_t end)->void
+    {
+        func(static_cast<eigen_size_t>(begin), static_cast<eigen_size_t>(end - begin));
+    });
+}
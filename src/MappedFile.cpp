@@ -0,0 +1,95 @@
+// MappedFile.cpp
+
+#include "omnilearn/MappedFile.hh"
+
+#ifdef _WIN32
+#include <fstream>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+
+
+omnilearn::MappedFile::MappedFile(std::string const& path):
+_data(nullptr),
+_size(0),
+_buffer()
+{
+#ifdef _WIN32
+    std::ifstream file(path, std::ios::binary | std::ios::ate);
+    if(!file)
+        throw Exception("Cannot open " + path + ".");
+    _buffer.resize(static_cast<size_t>(file.tellg()));
+    file.seekg(0);
+    file.read(_buffer.data(), static_cast<std::streamsize>(_buffer.size()));
+    _data = _buffer.data();
+    _size = _buffer.size();
+#else
+    int fd = open(path.c_str(), O_RDONLY);
+    if(fd < 0)
+        throw Exception("Cannot open " + path + ".");
+    struct stat info;
+    if(fstat(fd, &info) != 0)
+    {
+        close(fd);
+        throw Exception("Cannot read the size of " + path + ".");
+    }
+    _size = static_cast<size_t>(info.st_size);
+    //an empty file cannot be mapped
+    if(_size > 0)
+    {
+        void* mapping = mmap(nullptr, _size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if(mapping == MAP_FAILED)
+        {
+            close(fd);
+            throw Exception("Cannot map " + path + " in memory.");
+        }
+        madvise(mapping, _size, MADV_SEQUENTIAL);
+        _data = static_cast<char const*>(mapping);
+    }
+    //the mapping stays valid after closing the file
+    close(fd);
+#endif
+}
+
+
+omnilearn::MappedFile::~MappedFile()
+{
+#ifndef _WIN32
+    if(_data != nullptr)
+        munmap(const_cast<char*>(_data), _size);
+#endif
+}
+
+
+char const* omnilearn::MappedFile::data() const
+{
+    return _data;
+}
+
+
+size_t omnilearn::MappedFile::size() const
+{
+    return _size;
+}
+
+
+size_t omnilearn::align64(size_t offset)
+{
+    return (offset + 63) / 64 * 64;
+}
+
+
+bool omnilearn::blockFits(size_t offset, uint64_t rows, uint64_t cols, size_t size)
+{
+    //an empty block can't have a dimension larger than the file either
+    if(offset > size || rows > size || cols > size)
+        return false;
+    if(rows == 0 || cols == 0)
+        return true;
+    size_t available = (size - offset) / sizeof(double);
+    return cols <= available && rows <= available / cols;
+}
\ No newline at end of file
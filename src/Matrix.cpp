@@ -24,4 +24,11 @@ double omnilearn::norm(Vector const& vec, double order)
 double omnilearn::normInf(Vector const& vec)
 {
   return vec.maxCoeff();
-}
\ No newline at end of file
+}
+
+
+void omnilearn::multiplyTransposed(Eigen::Ref<Matrix const> const& lhs, Eigen::Ref<Matrix const> const& rhs, Eigen::Ref<Matrix> dest)
+{
+  for(eigen_size_t i = 0; i < lhs.rows(); i++)
+    dest.row(i).noalias() = lhs.row(i) * rhs.transpose();
+}
@@ -1,10 +1,16 @@
 // Network.cpp
 
 #include "omnilearn/Network.hh"
+#include "omnilearn/InferenceSession.hh"
 
+#include <cstring>
+#include <filesystem>
+#include <numeric>
+#include <sstream>
 
 
-omnilearn::Network::Network(Data const& data, NetworkParam const& param):
+
+omnilearn::Network::Network(Data data, NetworkParam const& param):
 _param(param),
 _seed(param.seed == 0 ? static_cast<size_t>(std::chrono::steady_clock().now().time_since_epoch().count()) : param.seed),
 _generator(std::mt19937(_seed)),
@@ -12,13 +18,18 @@ _dropoutDist(std::bernoulli_distribution(param.dropout)),
 _dropconnectDist(std::bernoulli_distribution(param.dropconnect)),
 _layers(),
 _pool(param.threads),
-_trainInputs(data.inputs),
-_trainOutputs(data.outputs),
-_validationInputs(),
-_validationOutputs(),
-_testInputs(),
-_testOutputs(),
+_serialPool(0),
+_replicas(),
+_source(),
+_heldOut(),
+_trainSize(static_cast<size_t>(data.inputs.rows())),
+_validationSize(0),
+_trainOrder(),
+_inputs(std::move(data.inputs)),
+_sparseInputs(std::move(data.sparseInputs)),
+_outputs(std::move(data.outputs)),
 _testRawInputs(),
+_testRawSparseInputs(),
 _testRawOutputs(),
 _testNormalizedOutputsForMetric(),
 _nbBatch(),
@@ -28,8 +39,8 @@ _trainLosses(),
 _validLosses(),
 _testMetric(),
 _testSecondMetric(),
-_inputLabels(data.inputLabels),
-_outputLabels(data.outputLabels),
+_inputLabels(std::move(data.inputLabels)),
+_outputLabels(std::move(data.outputLabels)),
 _outputCenter(),
 _outputNormalization(),
 _outputDecorrelation(),
@@ -37,14 +48,37 @@ _metricNormalization(),
 _inputCenter(),
 _inputNormalization(),
 _inputStandartization(),
-_inputDecorrelation()
+_inputDecorrelation(),
+_snapshot(),
+_snapshotCopy()
+{
+}
+
+
+omnilearn::Network::Network(NetworkParam const& param, Data data):
+Network(std::move(data), param)
+{
+}
+
+
+omnilearn::Network::Network(std::shared_ptr<DataSource const> const& source, NetworkParam const& param):
+Network(Data(), param)
 {
+  _source = source;
+  _inputLabels = source->inputLabels();
+  _outputLabels = source->outputLabels();
 }
 
 
-omnilearn::Network::Network(NetworkParam const& param, Data const& data):
-Network(data, param)
+//coefficients of a saved neuron starting at pos, preceded by their number
+static Eigen::Map<omnilearn::Vector const> nextCoefs(std::vector<double> const& line, size_t& pos)
 {
+  if(pos >= line.size() || pos + 1 + static_cast<size_t>(line[pos]) > line.size())
+    throw omnilearn::Exception("A saved neuron is truncated.");
+  size_t count = static_cast<size_t>(line[pos]);
+  double const* coefs = line.data() + pos + 1;
+  pos += count + 1;
+  return Eigen::Map<omnilearn::Vector const>(coefs, static_cast<eigen_size_t>(count));
 }
 
 
@@ -56,13 +90,18 @@ _dropoutDist(),
 _dropconnectDist(),
 _layers(),
 _pool(threads),
-_trainInputs(),
-_trainOutputs(),
-_validationInputs(),
-_validationOutputs(),
-_testInputs(),
-_testOutputs(),
+_serialPool(0),
+_replicas(),
+_source(),
+_heldOut(),
+_trainSize(0),
+_validationSize(0),
+_trainOrder(),
+_inputs(),
+_sparseInputs(),
+_outputs(),
 _testRawInputs(),
+_testRawSparseInputs(),
 _testRawOutputs(),
 _testNormalizedOutputsForMetric(),
 _nbBatch(),
@@ -81,20 +120,27 @@ _metricNormalization(),
 _inputCenter(),
 _inputNormalization(),
 _inputStandartization(),
-_inputDecorrelation()
+_inputDecorrelation(),
+_snapshot(),
+_snapshotCopy()
 {
-  std::vector<std::string> out = readCleanLines(path + ".out");
-  std::vector<std::string> save = readCleanLines(path + ".save");
-  std::string line;
-  std::vector<std::string> vec;
-  std::vector<std::string> vec2;
+  _param.threads = threads;
+  if(std::filesystem::exists(path + ".omnimodel"))
+  {
+    loadNetFromBinaryFile(path + ".omnimodel");
+    return;
+  }
 
-  for(size_t i = 0; i < out.size(); i++)
-    out[i] = strip(out[i], ',');
+  //the files are mapped and cut into lines without copy
+  MappedFile outFile(path + ".out");
+  MappedFile saveFile(path + ".save");
+  std::vector<std::string_view> out = splitLines(std::string_view(outFile.data(), outFile.size()), " \t\r,");
+  std::vector<std::string_view> save = splitLines(std::string_view(saveFile.data(), saveFile.size()), " \t\r");
+  std::string_view line;
+  std::vector<double> vec;
+  std::vector<double> vec2;
 
   // read .out to create param
-  _param.threads = threads;
-
   for(size_t i = 0; i < out.size(); i++)
   {
     line = out[i];
@@ -112,8 +158,7 @@ _inputDecorrelation()
     }
     else if(line == "input preprocess:")
     {
-      vec = split(out[i+1], ',');
-      for(std::string const& a : vec)
+      for(std::string const& a : split(std::string(out[i+1]), ','))
       {
         if(a == "center")
           _param.preprocessInputs.push_back(Preprocess::Center);
@@ -134,14 +179,14 @@ _inputDecorrelation()
       line = out[i+1];
       if(line != "0")
       {
-        vec = split(line, ',');
+        vec = parseNumbers(line);
         _inputDecorrelation.second = Vector(vec.size());
         for(size_t j = 0; j < vec.size(); j++)
         {
-          _inputDecorrelation.second[j] = std::stod(vec[j]);
+          _inputDecorrelation.second[j] = vec[j];
         }
-        _param.inputReductionThreshold = std::stod(out[i+2]);
-        _param.inputWhiteningBias = std::stod(out[i+3]);
+        _param.inputReductionThreshold = parseNumber(out[i+2]);
+        _param.inputWhiteningBias = parseNumber(out[i+3]);
       }
     }
     else if(line == "input eigenvectors:")
@@ -149,7 +194,7 @@ _inputDecorrelation()
       line = out[i+1];
       if(line != "0")
       {
-        vec = split(line, ',');
+        vec = parseNumbers(line);
 
         // the following statement in the loop implies that
         // input eigenvalues is loaded before the input eigenvectors
@@ -158,10 +203,10 @@ _inputDecorrelation()
         for(eigen_size_t j = 0; j < _inputDecorrelation.second.size(); j++)
         {
           line = out[i+1+j];
-          vec = split(line, ',');
+          vec = parseNumbers(line);
           for(size_t k = 0; k < vec.size(); k++)
           {
-            _inputDecorrelation.first(j, k) = std::stod(vec[k]);
+            _inputDecorrelation.first(j, k) = vec[k];
           }
         }
         _inputDecorrelation.first.transposeInPlace();
@@ -172,11 +217,11 @@ _inputDecorrelation()
       line = out[i+1];
       if(line != "0")
       {
-        vec = split(line, ',');
+        vec = parseNumbers(line);
         _inputCenter = Vector(vec.size());
         for(size_t j = 0; j < vec.size(); j++)
         {
-          _inputCenter[j] = std::stod(vec[j]);
+          _inputCenter[j] = vec[j];
         }
       }
     }
@@ -185,13 +230,13 @@ _inputDecorrelation()
       line = out[i+1];
       if(line != "0")
       {
-        vec = split(line, ',');
-        vec2 = split(out[i+2], ',');
+        vec = parseNumbers(line);
+        vec2 = parseNumbers(out[i+2]);
         _inputNormalization = std::vector<std::pair<double, double>>(vec.size());
         for(size_t j = 0; j < vec.size(); j++)
         {
-          _inputNormalization[j].first = std::stod(vec[j]);
-          _inputNormalization[j].second = std::stod(vec2[j]);
+          _inputNormalization[j].first = vec[j];
+          _inputNormalization[j].second = vec2[j];
         }
       }
     }
@@ -200,20 +245,19 @@ _inputDecorrelation()
       line = out[i+1];
       if(line != "0")
       {
-        vec = split(line, ',');
-        vec2 = split(out[i+2], ',');
+        vec = parseNumbers(line);
+        vec2 = parseNumbers(out[i+2]);
         _inputStandartization = std::vector<std::pair<double, double>>(vec.size());
         for(size_t j = 0; j < vec.size(); j++)
         {
-          _inputStandartization[j].first = std::stod(vec[j]);
-          _inputStandartization[j].second = std::stod(vec2[j]);
+          _inputStandartization[j].first = vec[j];
+          _inputStandartization[j].second = vec2[j];
         }
       }
     }
     else if(line == "output preprocess:")
     {
-      vec = split(out[i+1], ',');
-      for(std::string const& a : vec)
+      for(std::string const& a : split(std::string(out[i+1]), ','))
       {
         if(a == "center")
           _param.preprocessOutputs.push_back(Preprocess::Center);
@@ -234,14 +278,14 @@ _inputDecorrelation()
       line = out[i+1];
       if(line != "0")
       {
-        vec = split(line, ',');
+        vec = parseNumbers(line);
         _outputDecorrelation.second = Vector(vec.size());
         for(size_t j = 0; j < vec.size(); j++)
         {
-          _outputDecorrelation.second[j] = std::stod(vec[j]);
+          _outputDecorrelation.second[j] = vec[j];
         }
-        _param.outputReductionThreshold = std::stod(out[i+2]);
-        //_param.outputWhiteningBias = std::stod(out[i+3]);
+        _param.outputReductionThreshold = parseNumber(out[i+2]);
+        //_param.outputWhiteningBias = parseNumber(out[i+3]);
       }
     }
     else if(line == "output eigenvectors:")
@@ -249,7 +293,7 @@ _inputDecorrelation()
       line = out[i+1];
       if(line != "0")
       {
-        vec = split(line, ',');
+        vec = parseNumbers(line);
 
         // the following statement in the loop implies that
         // output eigenvalues is loaded before the output eigenvectors
@@ -258,10 +302,10 @@ _inputDecorrelation()
         for(eigen_size_t j = 0; j < _outputDecorrelation.second.size(); j++)
         {
           line = out[i+1+j];
-          vec = split(line, ',');
+          vec = parseNumbers(line);
           for(size_t k = 0; k < vec.size(); k++)
           {
-              _outputDecorrelation.first(j, k) = std::stod(vec[k]);
+              _outputDecorrelation.first(j, k) = vec[k];
           }
         }
         _outputDecorrelation.first.transposeInPlace();
@@ -272,11 +316,11 @@ _inputDecorrelation()
       line = out[i+1];
       if(line != "0")
       {
-        vec = split(line, ',');
+        vec = parseNumbers(line);
         _outputCenter = Vector(vec.size());
         for(size_t j = 0; j < vec.size(); j++)
         {
-          _outputCenter[j] = std::stod(vec[j]);
+          _outputCenter[j] = vec[j];
         }
       }
     }
@@ -285,80 +329,52 @@ _inputDecorrelation()
       line = out[i+1];
       if(line != "0")
       {
-        vec = split(line, ',');
-        vec2 = split(out[i+2], ',');
+        vec = parseNumbers(line);
+        vec2 = parseNumbers(out[i+2]);
         _outputNormalization = std::vector<std::pair<double, double>>(vec.size());
         for(size_t j = 0; j < vec.size(); j++)
         {
-          _outputNormalization[j].first = std::stod(vec[j]);
-          _outputNormalization[j].second = std::stod(vec2[j]);
+          _outputNormalization[j].first = vec[j];
+          _outputNormalization[j].second = vec2[j];
         }
       }
     }
   }
 
-  // read .save to load all weights / bias / coefs
+  // read .save to load all weights / bias / coefs, the lines of the neurons are parsed in parallel
   for(size_t i = 0; i < save.size(); i++)
   {
     line = save[i];
     if(line.substr(0, 7) == "Layer: ")
     {
-      size_t nbNeurons = std::stoi(line.erase(0, 7));
-      i++;
-      line = save[i];
-      size_t aggreg = std::stoi(line.substr(0, line.find_first_of(" ")));
-      size_t activ = std::stoi(line.substr(line.find_first_of(" ")+1, line.size()));
+      size_t nbNeurons = static_cast<size_t>(parseNumber(line.substr(7)));
+      if(i + 2 + nbNeurons > save.size())
+        throw Exception(path + ".save is truncated.");
+      vec = parseNumbers(save[i+1]);
       LayerParam param;
       param.size = nbNeurons;
-      addLayer(param, aggreg, activ);
-      size_t weightsPerSet = 0; //used to init the layer at the end
-      i++;
-      for(size_t j = 0; j < nbNeurons; i++, j++)
-      {
-        vec = split(save[i], ' ');
-
-        // load aggreg coefs
-        size_t nbAggreg = std::stoi(vec[0]);
-        Vector aggregation(nbAggreg);
-        for(size_t k = 0; k < nbAggreg; k++)
-        {
-          aggregation[k] = std::stod(vec[k + 1]);
-        }
+      addLayer(param, static_cast<size_t>(vec.at(0)), static_cast<size_t>(vec.at(1)));
 
-        // load activ coefs
-        size_t nbActiv = std::stoi(vec[nbAggreg + 1]);
-        Vector activation(nbActiv);
-        for(size_t k = 0; k < nbActiv; k++)
-        {
-          activation[k] = std::stod(vec[k + nbAggreg + 2]);
-        }
-
-        // load bias
-        size_t nbBias = std::stoi(vec[nbAggreg + nbActiv + 2]);
-        Vector bias(nbBias);
-        for(size_t k = 0; k < nbBias; k++)
-        {
-          bias[k] = std::stod(vec[k + nbAggreg + nbActiv + 3]);
-        }
+      std::vector<std::vector<double>> neurons(nbNeurons);
+      _pool.parallel_for(0, nbNeurons, ThreadPool::grain(save[i+2].size()), [&neurons, &save, i](size_t begin, size_t end)->void
+      {
+        for(size_t j = begin; j < end; j++)
+          neurons[j] = parseNumbers(save[i + 2 + j]);
+      });
 
-        // load weights
-        size_t nbWeights = std::stoi(vec[nbAggreg + nbActiv + nbBias + 3]);
-        Vector weights(nbWeights);
-        for(size_t k = 0; k < nbWeights; k++)
-        {
-          weights[k] = std::stod(vec[k + nbAggreg + nbActiv + nbBias + 4]);
-        }
+      size_t weightsPerSet = 0; //used to init the layer at the end
+      for(size_t j = 0; j < nbNeurons; j++)
+      {
+        //aggregation coefs, activation coefs, bias and weights, each one preceded by its size
+        size_t pos = 0;
+        Vector aggregation = nextCoefs(neurons[j], pos);
+        Vector activation = nextCoefs(neurons[j], pos);
+        Vector bias = nextCoefs(neurons[j], pos);
+        Eigen::Map<Vector const> weights = nextCoefs(neurons[j], pos);
 
-        // divide weights into wheight sets
-        weightsPerSet = nbWeights/nbBias;
-        Matrix sets(nbBias, weightsPerSet);
-        for(size_t k = 0; k < nbBias; k++)
-        {
-          for(size_t l = 0; l < weightsPerSet; l++)
-          {
-            sets(k, l) = weights[k*weightsPerSet + l];
-          }
-        }
+        // weight sets of a neuron are contiguous
+        weightsPerSet = static_cast<size_t>(weights.size() / std::max<eigen_size_t>(1, bias.size()));
+        Eigen::Map<Matrix const> sets(weights.data(), bias.size(), static_cast<eigen_size_t>(weightsPerSet));
 
         // put the coefs into the neuron
         _layers[_layers.size()-1].setCoefs(j, sets, bias, aggregation, activation);
@@ -368,7 +384,7 @@ _inputDecorrelation()
         _layers[_layers.size()-1].init(weightsPerSet);
       else
         _layers[_layers.size()-1].init(_layers[_layers.size()-2].size());
-      i--;
+      i += nbNeurons + 1;
     }
   }
 } // end of the loading constructor
@@ -382,35 +398,62 @@ void omnilearn::Network::addLayer(LayerParam const& param, size_t aggregation, s
 
 void omnilearn::Network::setTestData(Data const& data)
 {
-  _testInputs = data.inputs;
-  _testOutputs = data.outputs;
-
-  //_testRawInputs = data.inputs;
-  //_testRawOutputs = data.outputs;
-  //not needed because they are set in the shuffle function
+  _testRawInputs = data.inputs;
+  _testRawSparseInputs = data.sparseInputs;
+  _testRawOutputs = data.outputs;
 }
 
 
 bool omnilearn::Network::learn()
 {
-  shuffleData();
-  preprocess();
-  _layers[_layers.size()-1].resize(static_cast<size_t>(_trainOutputs.cols()));
+  prepareData(true);
+  initLearning();
+  double lowestLoss = computeLoss();
+  std::cout << "\n";
+  return train(1, lowestLoss);
+}
+
+
+//statistics is false when the preprocessing parameters are already known (resume)
+void omnilearn::Network::prepareData(bool statistics)
+{
+  if(_source)
+  {
+    initStream(statistics);
+  }
+  else
+  {
+    shuffleData();
+    preprocess(statistics);
+  }
+}
+
+
+void omnilearn::Network::initLearning()
+{
+  _layers[_layers.size()-1].resize(static_cast<size_t>(_outputs.cols()));
   initLayers();
 
   _testNormalizedOutputsForMetric = _testRawOutputs;
   _metricNormalization = normalize(_testNormalizedOutputsForMetric);
 
-  std::cout << "inputs: " << _trainInputs.cols() << "/" << _testRawInputs.cols()<<"\n";
-  std::cout << "outputs: " << _trainOutputs.cols() << "/" << _testRawOutputs.cols()<<"\n";
+  if(sparseInputs())
+    std::cout << "inputs: " << _sparseInputs.cols() << "/" << _testRawSparseInputs.cols() << " (sparse)\n";
+  else
+    std::cout << "inputs: " << _inputs.cols() << "/" << _testRawInputs.cols()<<"\n";
+  std::cout << "outputs: " << _outputs.cols() << "/" << _testRawOutputs.cols()<<"\n";
+}
+
 
-  double lowestLoss = computeLoss();
-  std::cout << "\n";
-  for(_epoch = 1; _epoch < _param.epoch; _epoch++)
+bool omnilearn::Network::train(size_t firstEpoch, double lowestLoss)
+{
+  for(_epoch = firstEpoch; _epoch < _param.epoch; _epoch++)
   {
+    auto epochStart = std::chrono::steady_clock::now();
     performeOneEpoch();
+    double epochTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - epochStart).count();
 
-    std::cout << "Epoch: " << _epoch;
+    std::cout << "Epoch: " << _epoch << "   samples/s: " << static_cast<double>(_trainSize) / epochTime;
     double validLoss = computeLoss();
 
     double lr = _param.learningRate;
@@ -426,7 +469,10 @@ bool omnilearn::Network::learn()
 
     std::cout << "   LR: " << lr << "   gap from opti: " << 100 * validLoss / lowestLoss << "%   Remain. epochs: " << _optimalEpoch + _param.patience - _epoch + 1<< "\n";
     if(std::isnan(_trainLosses[_epoch]) || std::isnan(validLoss) || std::isnan(_testMetric[_epoch]))
+    {
+      waitSnapshot(true);
       return false;
+    }
 
     //EARLY STOPPING
     if(validLoss < lowestLoss * _param.plateau) //if loss increases, or doesn't decrease more than _param.plateau percent in _param.patience epochs, stop learning
@@ -438,100 +484,212 @@ bool omnilearn::Network::learn()
     if(_epoch - _optimalEpoch > _param.patience)
       break;
 
-    //shuffle train data between each epoch
-    shuffleTrainData();
+    //shuffle train data between each epoch (streamed blocks are shuffled while being read)
+    if(!_source)
+      shuffleTrainData();
+
+    if(_param.checkpointInterval != 0 && _epoch % _param.checkpointInterval == 0)
+    {
+      //the checkpoint holds the saved parameters
+      waitSnapshot(false);
+      saveCheckpoint(_param.name + ".checkpoint", lowestLoss);
+    }
   }
+  waitSnapshot(true);
   loadSaved();
   std::cout << "\nOptimal epoch: " << _optimalEpoch << "   First metric: " << _testMetric[_optimalEpoch] << "   Second metric: " << _testSecondMetric[_optimalEpoch] << "\n";
   writeInfo(_param.name + ".out");
   saveNetInFile(_param.name + ".save");
+  saveNetInBinaryFile(_param.name + ".omnimodel");
   return true;
 }
 
 
 omnilearn::Matrix omnilearn::Network::process(Matrix inputs) const
 {
-  //preprocess inputs
-  for(size_t i = 0; i < _param.preprocessInputs.size(); i++)
+  if(rowParallel(static_cast<size_t>(inputs.rows())))
+    return processRowBlocks(inputs);
+  preprocessInputs(inputs, 0, _param.preprocessInputs.size());
+  return postprocess(processForLoss(std::move(inputs)));
+}
+
+
+//only if the network has been trained on sparse inputs (no input preprocessing)
+omnilearn::Matrix omnilearn::Network::process(SparseMatrix const& inputs) const
+{
+  return postprocess(processForLoss(inputs));
+}
+
+
+//layer by layer, the slice of a thread is too large for its cache and each activation goes back to memory before the next layer.
+//Row blocks keep the activations of a thread in its cache, but need enough of them to balance the load.
+//Distance aggregation still splits its layers by neurons
+bool omnilearn::Network::rowParallel(size_t rows) const
+{
+  for(size_t i = 0; i < _layers.size(); i++)
+    if(_layers[i].getFunctions().first == Aggregation::Distance)
+      return false;
+  return rows >= 4 * _pool.size() * InferenceSession::blockRows(*this);
+}
+
+
+//the preprocessing maps are computed once, then copied with the buffers of each worker's session.
+//Each worker takes the next block of rows
+omnilearn::Matrix omnilearn::Network::processRowBlocks(Matrix const& inputs) const
+{
+  size_t block = InferenceSession::blockRows(*this);
+  size_t rows = static_cast<size_t>(inputs.rows());
+  size_t blocks = (rows + block - 1) / block;
+  size_t workers = std::min(_pool.size(), blocks);
+  std::vector<InferenceSession> sessions;
+  sessions.reserve(workers);
+  sessions.emplace_back(*this, block);
+  while(sessions.size() < workers)
+    sessions.push_back(sessions.front());
+
+  Matrix outputs(inputs.rows(), static_cast<eigen_size_t>(sessions.front().outputSize()));
+  std::atomic<size_t> nextBlock(0);
+  _pool.parallel_for(0, sessions.size(), 1, [&inputs, &outputs, &sessions, &nextBlock, rows, blocks, block](size_t begin, size_t end)
   {
-    if(_param.preprocessInputs[i] == Preprocess::Center)
-    {
-      center(inputs, _inputCenter);
-    }
-    else if(_param.preprocessInputs[i] == Preprocess::Normalize)
-    {
-      normalize(inputs, _inputNormalization);
-    }
-    else if(_param.preprocessInputs[i] == Preprocess::Standardize)
-    {
-      standardize(inputs, _inputStandartization);
-    }
-    else if(_param.preprocessInputs[i] == Preprocess::Decorrelate)
-    {
-      decorrelate(inputs, _inputDecorrelation);
-    }
-    else if(_param.preprocessInputs[i] == Preprocess::Whiten)
+    for(size_t s = begin; s < end; s++)
     {
-      whiten(inputs, _inputDecorrelation, _param.inputWhiteningBias);
+      for(size_t b = nextBlock++; b < blocks; b = nextBlock++)
+      {
+        eigen_size_t first = static_cast<eigen_size_t>(b * block);
+        sessions[s].process(inputs.row(first).data(), std::min(block, rows - b * block), static_cast<size_t>(inputs.cols()),
+                            outputs.row(first).data(), static_cast<size_t>(outputs.cols()));
+      }
     }
-    else if(_param.preprocessInputs[i] == Preprocess::Reduce)
+  });
+  return outputs;
+}
+
+
+//transforms processed outputs to real values
+//the reduction drops dimensions of the rotated inputs, otherwise the first layer takes as many inputs as the raw features
+size_t omnilearn::Network::inputSize() const
+{
+  if(std::find(_param.preprocessInputs.begin(), _param.preprocessInputs.end(), Preprocess::Reduce) != _param.preprocessInputs.end())
+    return static_cast<size_t>(_inputDecorrelation.first.rows());
+  return static_cast<size_t>(_layers[0].getWeights().cols());
+}
+
+
+omnilearn::Matrix omnilearn::Network::postprocess(Matrix outputs) const
+{
+  for(size_t pre = _param.preprocessOutputs.size(); pre > 0; pre--)
+    restoreOutputs(outputs, pre - 1, true);
+  return outputs;
+}
+
+
+//each step is affine, offset false only applies its linear part
+void omnilearn::Network::restoreOutputs(Matrix& outputs, size_t step, bool offset) const
+{
+  if(_param.preprocessOutputs[step] == Preprocess::Normalize)
+  {
+    for(eigen_size_t j = 0; j < outputs.cols(); j++)
     {
-      reduce(inputs, _inputDecorrelation, _param.inputReductionThreshold);
+      outputs.col(j) *= (_outputNormalization[j].second - _outputNormalization[j].first);
+      if(offset)
+        outputs.col(j).array() += _outputNormalization[j].first;
     }
   }
-  //process
-  for(size_t i = 0; i < _layers.size(); i++)
+  else if(_param.preprocessOutputs[step] == Preprocess::Reduce)
   {
-    inputs = _layers[i].process(inputs, _pool);
+    //dropped dimensions are restored as zeros
+    eigen_size_t reduced = outputs.cols();
+    outputs.conservativeResize(Eigen::NoChange, _outputDecorrelation.second.size());
+    outputs.rightCols(outputs.cols() - reduced).setZero();
   }
-  // if cross-entropy loss is used, then score must be softmax
-  if(_param.loss == Loss::CrossEntropy)
+  else if(_param.preprocessOutputs[step] == Preprocess::Decorrelate)
   {
-    inputs = softmax(inputs);
+    outputs = outputs * _outputDecorrelation.first.transpose();
   }
-  //transform computed outputs to real values
-  for(size_t pre = 0; pre < _param.preprocessOutputs.size(); pre++)
+  else if(_param.preprocessOutputs[step] == Preprocess::Center && offset)
   {
-    if(_param.preprocessOutputs[_param.preprocessOutputs.size() - pre - 1] == Preprocess::Normalize)
-    {
-      for(eigen_size_t i = 0; i < inputs.rows(); i++)
-      {
-        for(eigen_size_t j = 0; j < inputs.cols(); j++)
-        {
-          inputs(i,j) *= (_outputNormalization[j].second - _outputNormalization[j].first);
-          inputs(i,j) += _outputNormalization[j].first;
-        }
-      }
-    }
-    else if(_param.preprocessOutputs[_param.preprocessOutputs.size() - pre - 1] == Preprocess::Reduce)
+    outputs.rowwise() += _outputCenter.transpose();
+  }
+}
+
+
+//each step is applied to the offset, and its linear part to A
+std::pair<omnilearn::Matrix, omnilearn::rowVector> omnilearn::Network::inputMap() const
+{
+  eigen_size_t raw = static_cast<eigen_size_t>(inputSize());
+  Matrix A = Matrix::Identity(raw, raw);
+  Matrix b = Matrix::Zero(1, raw);
+  for(size_t i = 0; i < _param.preprocessInputs.size(); i++)
+  {
+    preprocessInputs(b, i, i+1);
+    if(_param.preprocessInputs[i] == Preprocess::Normalize)
     {
-      Matrix newResults(inputs.rows(), _outputDecorrelation.second.size());
-      rowVector zero = rowVector::Constant(_outputDecorrelation.second.size() - inputs.cols(), 0);
-      for(eigen_size_t i = 0; i < inputs.rows(); i++)
-      {
-        newResults.row(i) = (rowVector(_outputDecorrelation.second.size()) << inputs.row(i), zero).finished();
-      }
-      inputs = newResults;
+      for(eigen_size_t j = 0; j < A.cols(); j++)
+        A.col(j) /= (_inputNormalization[j].second - _inputNormalization[j].first);
     }
-    else if(_param.preprocessOutputs[_param.preprocessOutputs.size() - pre - 1] == Preprocess::Decorrelate)
+    else if(_param.preprocessInputs[i] == Preprocess::Standardize)
     {
-      for(eigen_size_t i = 0; i < inputs.rows(); i++)
-      {
-        inputs.row(i) = _outputDecorrelation.first * inputs.row(i).transpose();
-      }
+      for(eigen_size_t j = 0; j < A.cols(); j++)
+        A.col(j) /= _inputStandartization[j].second;
     }
-    else if(_param.preprocessOutputs[_param.preprocessOutputs.size() - pre - 1] == Preprocess::Center)
+    else if(_param.preprocessInputs[i] != Preprocess::Center)
     {
-      for(eigen_size_t i = 0; i < inputs.rows(); i++)
-      {
-        for(eigen_size_t j = 0; j < inputs.cols(); j++)
-        {
-          inputs(i,j) += _outputCenter[j];
-        }
-      }
+      preprocessInputs(A, i, i+1);
     }
   }
-  return inputs;
+  return {A, b};
+}
+
+
+std::pair<omnilearn::Matrix, omnilearn::rowVector> omnilearn::Network::outputMap() const
+{
+  eigen_size_t outputs = static_cast<eigen_size_t>(_layers.back().size());
+  Matrix C = Matrix::Identity(outputs, outputs);
+  Matrix d = Matrix::Zero(1, outputs);
+  for(size_t pre = _param.preprocessOutputs.size(); pre > 0; pre--)
+  {
+    restoreOutputs(C, pre - 1, false);
+    restoreOutputs(d, pre - 1, true);
+  }
+  return {C, d};
+}
+
+
+//the first layer takes raw inputs with weights W * A^T and bias bias + W * b^T (inputMap),
+//the last layer gives restored outputs with weights C^T * W and bias C^T * bias + d^T (outputMap)
+bool omnilearn::Network::foldPreprocessing()
+{
+  if(!_param.preprocessInputs.empty() && (_layers[0].getFunctions().first == Aggregation::Dot || _layers[0].getFunctions().first == Aggregation::Maxout))
+  {
+    std::pair<Matrix, rowVector> map = inputMap();
+    Matrix weights = _layers[0].getWeights() * map.first.transpose();
+    Vector parameters(weights.size() + _layers[0].getBias().size());
+    Eigen::Map<Matrix>(parameters.data(), weights.rows(), weights.cols()) = weights;
+    parameters.tail(_layers[0].getBias().size()) = _layers[0].getBias() + _layers[0].getWeights() * map.second.transpose();
+    std::pair<rowVector, rowVector> coefs = _layers[0].getFunctionCoefs();
+    _layers[0].init(static_cast<size_t>(map.first.rows()));
+    _layers[0].setParameters(parameters, coefs.first.transpose(), coefs.second.transpose());
+    _param.preprocessInputs.clear();
+  }
+
+  Layer& last = _layers.back();
+  //with cross-entropy, the softmax is applied between the last layer and the restoring steps
+  if(!_param.preprocessOutputs.empty() && last.getFunctions() == std::pair<size_t, size_t>(Aggregation::Dot, Activation::Linear) &&
+     static_cast<size_t>(last.getWeights().rows()) == last.size() && _param.loss != Loss::CrossEntropy)
+  {
+    std::pair<Matrix, rowVector> map = outputMap();
+    Matrix weights = map.first.transpose() * last.getWeights();
+    Vector parameters(weights.size() + map.first.cols());
+    Eigen::Map<Matrix>(parameters.data(), weights.rows(), weights.cols()) = weights;
+    parameters.tail(map.first.cols()) = map.first.transpose() * last.getBias() + map.second.transpose();
+    std::pair<rowVector, rowVector> coefs = last.getFunctionCoefs();
+    size_t inputs = static_cast<size_t>(weights.cols());
+    last.resize(static_cast<size_t>(map.first.cols()));
+    last.init(inputs);
+    last.setParameters(parameters, coefs.first.transpose(), coefs.second.transpose());
+    _param.preprocessOutputs.clear();
+  }
+  return _param.preprocessInputs.empty() && _param.preprocessOutputs.empty();
 }
 
 
@@ -559,20 +717,20 @@ void omnilearn::Network::writeInfo(std::string const& path) const
       output << _outputLabels[i] << ",";
   output << "\n" << "loss:" << "\n" << loss << "\n";
   for(eigen_size_t i=0; i<_trainLosses.size(); i++)
-      output << _trainLosses[i] << ",";
+      output << toString(_trainLosses[i]) << ",";
   output << "\n";
   for(eigen_size_t i=0; i<_validLosses.size(); i++)
-      output << _validLosses[i] << ",";
+      output << toString(_validLosses[i]) << ",";
   output << "\n" << "metric:" << "\n";
   for(eigen_size_t i=0; i<_testMetric.size(); i++)
-      output << _testMetric[i] << ",";
+      output << toString(_testMetric[i]) << ",";
   output << "\n";
   for(eigen_size_t i=0; i<_testSecondMetric.size(); i++)
-      output << _testSecondMetric[i] << ",";
+      output << toString(_testSecondMetric[i]) << ",";
   if(loss == "binary cross entropy" || loss == "cross entropy")
   {
     output << "\nclassification threshold:\n";
-    output << _param.classValidity;
+    output << toString(_param.classValidity);
   }
   output << "\noptimal epoch:\n";
   output << _optimalEpoch << "\n";
@@ -600,10 +758,10 @@ void omnilearn::Network::writeInfo(std::string const& path) const
   else
   {
     for(eigen_size_t i = 0; i < _inputDecorrelation.second.size(); i++)
-      output << _inputDecorrelation.second[i] << ",";
+      output << toString(_inputDecorrelation.second[i]) << ",";
     output << "\n";
-    output << _param.inputReductionThreshold << "\n";
-    output << _param.inputWhiteningBias << "\n";
+    output << toString(_param.inputReductionThreshold) << "\n";
+    output << toString(_param.inputWhiteningBias) << "\n";
   }
   output << "input eigenvectors:\n";
   if(_inputDecorrelation.second.size() == 0)
@@ -614,7 +772,7 @@ void omnilearn::Network::writeInfo(std::string const& path) const
     for(eigen_size_t i = 0; i < _inputDecorrelation.first.rows(); i++)
     {
       for(eigen_size_t j = 0; j < _inputDecorrelation.first.cols(); j++)
-        output << vectors(i, j) << ",";
+        output << toString(vectors(i, j)) << ",";
       output << "\n";
     }
   }
@@ -623,7 +781,7 @@ void omnilearn::Network::writeInfo(std::string const& path) const
     output << 0;
   else
     for(eigen_size_t i=0; i<_inputCenter.size(); i++)
-        output << _inputCenter[i] << ",";
+        output << toString(_inputCenter[i]) << ",";
   output << "\n";
   output << "input normalization:\n";
   if(_inputNormalization.size() == 0)
@@ -631,10 +789,10 @@ void omnilearn::Network::writeInfo(std::string const& path) const
   else
   {
     for(size_t i=0; i<_inputNormalization.size(); i++)
-        output << _inputNormalization[i].first << ",";
+        output << toString(_inputNormalization[i].first) << ",";
     output << "\n";
     for(size_t i=0; i<_inputNormalization.size(); i++)
-        output << _inputNormalization[i].second << ",";
+        output << toString(_inputNormalization[i].second) << ",";
     output << "\n";
   }
   output << "input standardization:\n";
@@ -643,10 +801,10 @@ void omnilearn::Network::writeInfo(std::string const& path) const
   else
   {
     for(size_t i=0; i<_inputStandartization.size(); i++)
-        output << _inputStandartization[i].first << ",";
+        output << toString(_inputStandartization[i].first) << ",";
     output << "\n";
     for(size_t i=0; i<_inputStandartization.size(); i++)
-        output << _inputStandartization[i].second << ",";
+        output << toString(_inputStandartization[i].second) << ",";
     output << "\n";
   }
 
@@ -669,9 +827,9 @@ void omnilearn::Network::writeInfo(std::string const& path) const
   else
   {
     for(eigen_size_t i = 0; i < _outputDecorrelation.second.size(); i++)
-      output << _outputDecorrelation.second[i] << ",";
+      output << toString(_outputDecorrelation.second[i]) << ",";
     output << "\n";
-    output << _param.outputReductionThreshold << "\n";
+    output << toString(_param.outputReductionThreshold) << "\n";
   }
   output << "output eigenvectors:\n";
   if(_outputDecorrelation.second.size() == 0)
@@ -682,7 +840,7 @@ void omnilearn::Network::writeInfo(std::string const& path) const
     for(eigen_size_t i = 0; i < _outputDecorrelation.first.rows(); i++)
     {
       for(eigen_size_t j = 0; j < _outputDecorrelation.first.cols(); j++)
-        output << vectors(i, j) << ",";
+        output << toString(vectors(i, j)) << ",";
       output << "\n";
     }
   }
@@ -691,7 +849,7 @@ void omnilearn::Network::writeInfo(std::string const& path) const
     output << 0;
   else
     for(eigen_size_t i=0; i<_outputCenter.size(); i++)
-        output << _outputCenter[i] << ",";
+        output << toString(_outputCenter[i]) << ",";
   output << "\n";
   output << "output normalization:\n";
   if(_outputNormalization.size() == 0)
@@ -699,23 +857,23 @@ void omnilearn::Network::writeInfo(std::string const& path) const
   else
   {
     for(size_t i=0; i<_outputNormalization.size(); i++)
-        output << _outputNormalization[i].first << ",";
+        output << toString(_outputNormalization[i].first) << ",";
     output << "\n";
     for(size_t i=0; i<_outputNormalization.size(); i++)
-        output << _outputNormalization[i].second << ",";
+        output << toString(_outputNormalization[i].second) << ",";
     output << "\n";
   }
 
-  Matrix testRes(process(_testRawInputs));
+  Matrix testRes(processTestData());
   output << "expected and predicted values:\n";
   for(size_t i = 0; i < _outputLabels.size(); i++)
   {
     output << "label: " << _outputLabels[i] << "\n" ;
     for(eigen_size_t j = 0; j < _testRawOutputs.rows(); j++)
-      output << _testRawOutputs(j,i) << ",";
+      output << toString(_testRawOutputs(j,i)) << ",";
     output << "\n";
     for(eigen_size_t j = 0; j < testRes.rows(); j++)
-      output << testRes(j,i) << ",";
+      output << toString(testRes(j,i)) << ",";
     output << "\n";
   }
 }
@@ -730,284 +888,1210 @@ void omnilearn::Network::saveNetInFile(std::string const& path) const
   {
     output << "Layer: " << _layers[i].size() << "\n";
     std::vector<rowVector> coefs = _layers[i].getCoefs();
-    for(size_t j = 0; j < coefs.size(); j++)
-      output << coefs[j] << "\n";
+    //lines are formatted in parallel, then written in order
+    std::vector<std::string> lines(coefs.size());
+    _pool.parallel_for(0, coefs.size(), ThreadPool::grain(static_cast<size_t>(coefs.back().size())), [&coefs, &lines](size_t begin, size_t end)->void
+    {
+      for(size_t j = begin; j < end; j++)
+      {
+        for(eigen_size_t k = 0; k < coefs[j].size(); k++)
+        {
+          if(k != 0)
+            lines[j] += ' ';
+          appendNumber(lines[j], coefs[j][k]);
+        }
+        lines[j] += '\n';
+      }
+    });
+    for(size_t j = 0; j < lines.size(); j++)
+      output << lines[j];
   }
 }
 
 
-omnilearn::Vector omnilearn::Network::generate(NetworkParam param, Vector target, Vector input)
+//binary model (.omnimodel): a header, then blocks of values. Each block starts on a 64 bytes boundary
+//and is preceded by its number of lines and columns. Numbers are in the machine byte order
+static char const omnimodelMagic[8] = {'O', 'M', 'N', 'I', 'M', 'O', 'D', 'L'};
+static uint32_t const omnimodelVersion = 1;
+
+
+struct OmnimodelHeader
 {
-  if(input.size() == 0)
-  {
+  char magic[8];
+  uint32_t version;
+  uint32_t scalarSize; //size of each value, in bytes
+  uint32_t loss;
+  uint32_t layers;
+  double inputReductionThreshold;
+  double inputWhiteningBias;
+  double outputReductionThreshold;
+};
+
+
+static void writeBlock(std::ofstream& file, size_t& offset, double const* data, size_t rows, size_t cols)
+{
+  uint64_t shape[2] = {rows, cols};
+  file.write(reinterpret_cast<char const*>(shape), sizeof(shape));
+  offset += sizeof(shape);
+  std::string const padding(omnilearn::align64(offset) - offset, '\0');
+  file.write(padding.data(), static_cast<std::streamsize>(padding.size()));
+  offset = omnilearn::align64(offset);
+  file.write(reinterpret_cast<char const*>(data), static_cast<std::streamsize>(rows * cols * sizeof(double)));
+  offset += rows * cols * sizeof(double);
+}
 
-  }
-  for(size_t iteration = 0; iteration < param.epoch; iteration++)
-  {
-    Vector res = input;
-    for(size_t i = 0; i < _layers.size(); i++)
-    {
-      res = _layers[i].processToLearn(res, param.dropout, param.dropconnect, _dropoutDist, _dropconnectDist, _generator, _pool);
-    }
 
-    Vector gradients(computeGradVector(target, res));
-    for(size_t i = 0; i < _layers.size() - 1; i++)
-    {
-      _layers[_layers.size() - i - 1].computeGradients(gradients, _pool);
-      gradients = _layers[_layers.size() - i - 1].getGradients(_pool);
-    }
-    _layers[0].computeGradientsAccordingToInputs(gradients, _pool);
-    gradients = _layers[0].getGradients(_pool);
-    //_layers[0].updateInputs(input, gradients, _pool);
-  }
-  return Vector();
+static void writeBlock(std::ofstream& file, size_t& offset, omnilearn::Matrix const& block)
+{
+  writeBlock(file, offset, block.data(), static_cast<size_t>(block.rows()), static_cast<size_t>(block.cols()));
 }
 
 
-void omnilearn::Network::initLayers()
+//view on the next block of the file
+static Eigen::Map<omnilearn::Matrix const> readBlock(omnilearn::MappedFile const& file, size_t& offset, std::string const& path)
 {
-  for(size_t i = 0; i < _layers.size(); i++)
+  uint64_t shape[2];
+  if(offset + sizeof(shape) > file.size())
+    throw omnilearn::Exception(path + " is truncated.");
+  std::memcpy(shape, file.data() + offset, sizeof(shape));
+  offset = omnilearn::align64(offset + sizeof(shape));
+  if(!omnilearn::blockFits(offset, shape[0], shape[1], file.size()))
+    throw omnilearn::Exception(path + " is truncated.");
+  double const* block = reinterpret_cast<double const*>(file.data() + offset);
+  offset += shape[0] * shape[1] * sizeof(double);
+  return Eigen::Map<omnilearn::Matrix const>(block, static_cast<eigen_size_t>(shape[0]), static_cast<eigen_size_t>(shape[1]));
+}
+
+
+static omnilearn::Vector toVector(Eigen::Map<omnilearn::Matrix const> const& block)
+{
+  return Eigen::Map<omnilearn::Vector const>(block.data(), block.size());
+}
+
+
+//pairs are saved as two lines
+static omnilearn::Matrix pairsToBlock(std::vector<std::pair<double, double>> const& pairs)
+{
+  omnilearn::Matrix block(2, pairs.size());
+  for(size_t i = 0; i < pairs.size(); i++)
   {
-      _layers[i].init((i == 0 ? _trainInputs.cols() : _layers[i-1].size()),
-                      (i == _layers.size()-1 ? 0 : _layers[i+1].size()),
-                      _generator);
+    block(0, static_cast<eigen_size_t>(i)) = pairs[i].first;
+    block(1, static_cast<eigen_size_t>(i)) = pairs[i].second;
   }
+  return block;
 }
 
 
-void omnilearn::Network::shuffleTrainData()
+static std::vector<std::pair<double, double>> blockToPairs(Eigen::Map<omnilearn::Matrix const> const& block)
 {
-  //shuffle inputs and outputs in the same order
-  std::vector<size_t> indexes(_trainInputs.rows(), 0);
-  for(size_t i = 0; i < indexes.size(); i++)
-    indexes[i] = i;
-  std::shuffle(indexes.begin(), indexes.end(), _generator);
+  std::vector<std::pair<double, double>> pairs(static_cast<size_t>(block.rows() == 2 ? block.cols() : 0));
+  for(size_t i = 0; i < pairs.size(); i++)
+    pairs[i] = {block(0, static_cast<eigen_size_t>(i)), block(1, static_cast<eigen_size_t>(i))};
+  return pairs;
+}
 
-  Matrix temp = Matrix(_trainInputs.rows(), _trainInputs.cols());
-  for(size_t i = 0; i < indexes.size(); i++)
-    temp.row(i) = _trainInputs.row(indexes[i]);
-  std::swap(_trainInputs, temp);
 
-  temp = Matrix(_trainOutputs.rows(), _trainOutputs.cols());
-  for(size_t i = 0; i < indexes.size(); i++)
-    temp.row(i) = _trainOutputs.row(indexes[i]);
-  std::swap(_trainOutputs, temp);
+static omnilearn::Matrix stepsToBlock(std::vector<omnilearn::Preprocess> const& steps)
+{
+  omnilearn::Matrix block(1, steps.size());
+  for(size_t i = 0; i < steps.size(); i++)
+    block(0, static_cast<eigen_size_t>(i)) = static_cast<double>(steps[i]);
+  return block;
 }
 
 
-void omnilearn::Network::shuffleData()
+//each step must be one of the Preprocess values, a damaged file would give any double
+static std::vector<omnilearn::Preprocess> blockToSteps(Eigen::Map<omnilearn::Matrix const> const& block, std::string const& path)
 {
-  shuffleTrainData();
+  std::vector<omnilearn::Preprocess> steps(static_cast<size_t>(block.size()));
+  for(size_t i = 0; i < steps.size(); i++)
+  {
+    double step = block.data()[i];
+    if(!(step >= 0 && step <= static_cast<double>(omnilearn::Preprocess::Reduce)) || step != std::trunc(step))
+      throw omnilearn::Exception(path + " is corrupted.");
+    steps[i] = static_cast<omnilearn::Preprocess>(step);
+  }
+  return steps;
+}
 
-  if(_testInputs.rows() != 0 && std::abs(_param.testRatio) > std::numeric_limits<double>::epsilon())
-    throw Exception("TestRatio must be set to 0 because you already set a test dataset.");
 
-  double validation = _param.validationRatio * static_cast<double>(_trainInputs.rows());
-  double test = _param.testRatio * static_cast<double>(_trainInputs.rows());
-  double nbBatch = std::trunc(static_cast<double>(_trainInputs.rows()) - validation - test) / static_cast<double>(_param.batchSize);
-  if(_param.batchSize == 0)
-    nbBatch = 1; // if batch size == 0, then is batch gradient descend
+//checkpoints (.checkpoint) have the same layout as models, followed by the training state
+static char const checkpointMagic[8] = {'O', 'M', 'N', 'I', 'C', 'K', 'P', 'T'};
 
-  //add a batch if an incomplete batch has more than 0.5*batchsize data
-  if(nbBatch - std::trunc(nbBatch) >= 0.5)
-    nbBatch = std::trunc(nbBatch) + 1;
 
-  size_t noTrain = _trainInputs.rows() - (static_cast<size_t>(nbBatch)*_param.batchSize);
-  validation = std::round(static_cast<double>(noTrain)*_param.validationRatio/(_param.validationRatio + _param.testRatio));
-  test = std::round(static_cast<double>(noTrain)*_param.testRatio/(_param.validationRatio + _param.testRatio));
+static void writeHeader(std::ofstream& file, char const* magic, omnilearn::NetworkParam const& param, size_t layers)
+{
+  OmnimodelHeader header;
+  std::memcpy(header.magic, magic, sizeof(header.magic));
+  header.version = omnimodelVersion;
+  header.scalarSize = sizeof(double);
+  header.loss = static_cast<uint32_t>(param.loss);
+  header.layers = static_cast<uint32_t>(layers);
+  header.inputReductionThreshold = param.inputReductionThreshold;
+  header.inputWhiteningBias = param.inputWhiteningBias;
+  header.outputReductionThreshold = param.outputReductionThreshold;
+  file.write(reinterpret_cast<char const*>(&header), sizeof(header));
+}
 
-  _validationInputs = Matrix(static_cast<size_t>(validation), _trainInputs.cols());
-  _validationOutputs = Matrix(static_cast<size_t>(validation), _trainOutputs.cols());
-  if(_testInputs.rows() == 0)
-  {
-    _testInputs = Matrix(static_cast<size_t>(test), _trainInputs.cols());
-    _testOutputs = Matrix(static_cast<size_t>(test), _trainOutputs.cols());
-  }
-  for(size_t i = 0; i < static_cast<size_t>(validation); i++)
-  {
-    _validationInputs.row(i) = _trainInputs.row(_trainInputs.rows()-1-i);
-    _validationOutputs.row(i) = _trainOutputs.row(_trainOutputs.rows()-1-i);
-  }
-  for(size_t i = 0; i < static_cast<size_t>(test); i++)
+
+//header of a model or of a checkpoint
+static OmnimodelHeader readHeader(omnilearn::MappedFile const& file, std::string const& path)
+{
+  OmnimodelHeader header;
+  if(file.size() < sizeof(header))
+    throw omnilearn::Exception(path + " is not an omnimodel file.");
+  std::memcpy(&header, file.data(), sizeof(header));
+  if(std::memcmp(header.magic, omnimodelMagic, sizeof(header.magic)) != 0 && std::memcmp(header.magic, checkpointMagic, sizeof(header.magic)) != 0)
+    throw omnilearn::Exception(path + " is not an omnimodel file.");
+  if(header.version != omnimodelVersion || header.scalarSize != sizeof(double))
+    throw omnilearn::Exception(path + " has an unsupported omnimodel version.");
+  if(header.loss > static_cast<uint32_t>(omnilearn::Loss::BinaryCrossEntropy) || header.layers == 0)
+    throw omnilearn::Exception(path + " is corrupted.");
+  return header;
+}
+
+
+//binary model (.omnimodel): topology, coefficients and preprocessing, loaded without parsing
+void omnilearn::Network::saveNetInBinaryFile(std::string const& path) const
+{
+  writeModelFile(path, false);
+}
+
+
+void omnilearn::Network::writeModelFile(std::string const& path, bool saved) const
+{
+  std::string const tmpPath = path + ".tmp";
   {
-    _testInputs.row(i) = _trainInputs.row(_trainInputs.rows()-1-i-static_cast<size_t>(validation));
-    _testOutputs.row(i) = _trainOutputs.row(_trainOutputs.rows()-1-i-static_cast<size_t>(validation));
+    std::ofstream file(tmpPath, std::ios::binary | std::ios::trunc);
+    if(!file)
+      throw Exception("Cannot open/create file " + tmpPath);
+    writeHeader(file, omnimodelMagic, _param, _layers.size());
+    size_t offset = sizeof(OmnimodelHeader);
+    writePreprocessBlocks(file, offset);
+    writeLayerBlocks(file, offset, saved);
+    if(!file)
+      throw Exception("Cannot write " + tmpPath + ".");
   }
-  _testRawInputs = _testInputs;
-  _testRawOutputs = _testOutputs;
-  _trainInputs = Matrix(_trainInputs.topRows(_trainInputs.rows() - static_cast<eigen_size_t>(validation) - static_cast<eigen_size_t>(test)));
-  _trainOutputs = Matrix(_trainOutputs.topRows(_trainOutputs.rows() - static_cast<eigen_size_t>(validation) - static_cast<eigen_size_t>(test)));
-  _nbBatch = static_cast<size_t>(nbBatch);
+  std::filesystem::rename(tmpPath, path);
 }
 
 
-void omnilearn::Network::preprocess()
+//the file is mapped and each block is copied as a whole, nothing is parsed
+void omnilearn::Network::loadNetFromBinaryFile(std::string const& path)
 {
-  bool centered = false;
-  bool normalized = false;
-  bool standardized = false;
-  bool decorrelated = false;
-  bool whitened = false;
-  bool reduced = false;
+  MappedFile file(path);
+  OmnimodelHeader header = readHeader(file, path);
+  _param.loss = static_cast<Loss>(header.loss);
+  _param.inputReductionThreshold = header.inputReductionThreshold;
+  _param.inputWhiteningBias = header.inputWhiteningBias;
+  _param.outputReductionThreshold = header.outputReductionThreshold;
+  size_t offset = sizeof(header);
+  //the training state of a checkpoint is skipped
+  if(std::memcmp(header.magic, checkpointMagic, sizeof(header.magic)) == 0)
+    readBlock(file, offset, path);
+  readPreprocessBlocks(file, offset, path);
+  readLayerBlocks(file, offset, path, header.layers, true);
+  //without rotation, the raw features are the inputs of the first layer (the outputs of the last one)
+  std::pair<size_t, size_t> layers(static_cast<size_t>(_layers.front().getWeights().cols()), _layers.back().size());
+  size_t inputs = (_inputDecorrelation.second.size() != 0 ? static_cast<size_t>(_inputDecorrelation.second.size()) : layers.first);
+  size_t outputs = (_outputDecorrelation.second.size() != 0 ? static_cast<size_t>(_outputDecorrelation.second.size()) : layers.second);
+  if(checkPreprocessBlocks(path, inputs, outputs) != layers)
+    throw Exception(path + " is corrupted.");
+}
 
-  for(size_t i = 0; i < _param.preprocessInputs.size(); i++)
+
+void omnilearn::Network::writePreprocessBlocks(std::ofstream& file, size_t& offset) const
+{
+  writeBlock(file, offset, stepsToBlock(_param.preprocessInputs));
+  writeBlock(file, offset, stepsToBlock(_param.preprocessOutputs));
+  writeBlock(file, offset, _inputCenter);
+  writeBlock(file, offset, pairsToBlock(_inputNormalization));
+  writeBlock(file, offset, pairsToBlock(_inputStandartization));
+  writeBlock(file, offset, _inputDecorrelation.first);
+  writeBlock(file, offset, _inputDecorrelation.second);
+  writeBlock(file, offset, _outputCenter);
+  writeBlock(file, offset, pairsToBlock(_outputNormalization));
+  writeBlock(file, offset, _outputDecorrelation.first);
+  writeBlock(file, offset, _outputDecorrelation.second);
+}
+
+
+void omnilearn::Network::readPreprocessBlocks(MappedFile const& file, size_t& offset, std::string const& path)
+{
+  _param.preprocessInputs = blockToSteps(readBlock(file, offset, path), path);
+  _param.preprocessOutputs = blockToSteps(readBlock(file, offset, path), path);
+  _inputCenter = toVector(readBlock(file, offset, path));
+  _inputNormalization = blockToPairs(readBlock(file, offset, path));
+  _inputStandartization = blockToPairs(readBlock(file, offset, path));
+  _inputDecorrelation.first = readBlock(file, offset, path);
+  _inputDecorrelation.second = toVector(readBlock(file, offset, path));
+  _outputCenter = toVector(readBlock(file, offset, path));
+  _outputNormalization = blockToPairs(readBlock(file, offset, path));
+  _outputDecorrelation.first = readBlock(file, offset, path);
+  _outputDecorrelation.second = toVector(readBlock(file, offset, path));
+}
+
+
+//dimension of the features after the steps, which must fit the parameters of each step.
+//The rotations work on the raw features, the reduction keeps the dimensions reduce() would keep
+static size_t preprocessedSize(std::vector<omnilearn::Preprocess> const& steps, size_t center, size_t normalization, size_t standardization,
+                               std::pair<omnilearn::Matrix, omnilearn::Vector> const& decorrelation, double threshold, size_t raw, std::string const& path)
+{
+  size_t dim = raw;
+  for(omnilearn::Preprocess step : steps)
   {
-    if(_param.preprocessInputs[i] == Preprocess::Center)
-    {
-      if(centered == true)
-        throw Exception("Inputs are centered multiple times.");
-      _inputCenter = center(_trainInputs);
-      center(_validationInputs, _inputCenter);
-      center(_testInputs, _inputCenter);
-      centered = true;
-    }
-    else if(_param.preprocessInputs[i] == Preprocess::Normalize)
-    {
-      if(normalized == true)
-        throw Exception("Inputs are normalized multiple times.");
-      _inputNormalization = normalize(_trainInputs);
-      normalize(_validationInputs, _inputNormalization);
-      normalize(_testInputs, _inputNormalization);
-      normalized = true;
-    }
-    else if(_param.preprocessInputs[i] == Preprocess::Standardize)
-    {
-      if(standardized == true)
-        throw Exception("Inputs are standardized multiple times.");
-      _inputStandartization = standardize(_trainInputs);
-      standardize(_validationInputs, _inputStandartization);
-      standardize(_testInputs, _inputStandartization);
-      standardized = true;
-    }
-    else if(_param.preprocessInputs[i] == Preprocess::Decorrelate)
+    if((step == omnilearn::Preprocess::Center && center != dim) ||
+       (step == omnilearn::Preprocess::Normalize && normalization != dim) ||
+       (step == omnilearn::Preprocess::Standardize && standardization != dim))
+      throw omnilearn::Exception(path + " is corrupted.");
+    if(step == omnilearn::Preprocess::Decorrelate || step == omnilearn::Preprocess::Whiten || step == omnilearn::Preprocess::Reduce)
     {
-      if(decorrelated == true)
-        throw Exception("Inputs are decorrelated multiple times.");
-      _inputDecorrelation = decorrelate(_trainInputs);
-      decorrelate(_validationInputs, _inputDecorrelation);
-      decorrelate(_testInputs, _inputDecorrelation);
-      decorrelated = true;
+      eigen_size_t size = static_cast<eigen_size_t>(raw);
+      if(decorrelation.second.size() != size || decorrelation.first.rows() != size || decorrelation.first.cols() != size ||
+         (step == omnilearn::Preprocess::Decorrelate && dim != raw))
+        throw omnilearn::Exception(path + " is corrupted.");
     }
-    else if(_param.preprocessInputs[i] == Preprocess::Whiten)
+    if(step == omnilearn::Preprocess::Reduce)
     {
-      if(whitened == true)
-        throw Exception("Inputs are whitened multiple times.");
-      whiten(_trainInputs, _inputDecorrelation, _param.inputWhiteningBias);
-      whiten(_validationInputs, _inputDecorrelation, _param.inputWhiteningBias);
-      whiten(_testInputs, _inputDecorrelation, _param.inputWhiteningBias);
-      whitened = true;
+      double eigenTot = decorrelation.second.sum();
+      double eigenSum = 0;
+      for(size_t i = 0; i < raw; i++)
+      {
+        eigenSum += decorrelation.second[static_cast<eigen_size_t>(i)];
+        if(eigenSum/eigenTot >= threshold)
+        {
+          if(i + 1 > dim)
+            throw omnilearn::Exception(path + " is corrupted.");
+          dim = i + 1;
+          break;
+        }
+      }
     }
-    else if(_param.preprocessInputs[i] == Preprocess::Reduce)
+  }
+  return dim;
+}
+
+
+std::pair<size_t, size_t> omnilearn::Network::checkPreprocessBlocks(std::string const& path, size_t inputs, size_t outputs) const
+{
+  return {preprocessedSize(_param.preprocessInputs, static_cast<size_t>(_inputCenter.size()), _inputNormalization.size(), _inputStandartization.size(),
+                           _inputDecorrelation, _param.inputReductionThreshold, inputs, path),
+          preprocessedSize(_param.preprocessOutputs, static_cast<size_t>(_outputCenter.size()), _outputNormalization.size(), 0,
+                           _outputDecorrelation, _param.outputReductionThreshold, outputs, path)};
+}
+
+
+//layers: shape and functions, function coefficients, then the parameters as stored in the layer.
+//Function coefficients are not learned, the current ones are also the saved ones
+void omnilearn::Network::writeLayerBlocks(std::ofstream& file, size_t& offset, bool saved) const
+{
+  for(size_t i = 0; i < _layers.size(); i++)
+  {
+    Eigen::Map<Matrix const> weights = _layers[i].getWeights();
+    std::pair<size_t, size_t> functions = _layers[i].getFunctions();
+    std::pair<rowVector, rowVector> coefs = _layers[i].getFunctionCoefs();
+    Eigen::Map<Vector const> parameters = (saved ? _layers[i].getSavedParameters() : _layers[i].getParameters());
+    writeBlock(file, offset, (Matrix(1, 5) << static_cast<double>(_layers[i].size()), static_cast<double>(weights.rows()) / static_cast<double>(_layers[i].size()),
+                              static_cast<double>(weights.cols()), static_cast<double>(functions.first), static_cast<double>(functions.second)).finished());
+    writeBlock(file, offset, coefs.first);
+    writeBlock(file, offset, coefs.second);
+    writeBlock(file, offset, parameters.data(), 1, static_cast<size_t>(parameters.size()));
+  }
+}
+
+
+//creates the layers, or checks that the existing ones have the same shape and functions
+void omnilearn::Network::readLayerBlocks(MappedFile const& file, size_t& offset, std::string const& path, size_t layers, bool create)
+{
+  if(!create && layers != _layers.size())
+    throw Exception("The layers of " + path + " don't match the layers of the network.");
+  for(size_t i = 0; i < layers; i++)
+  {
+    Eigen::Map<Matrix const> shape = readBlock(file, offset, path);
+    if(shape.size() != 5)
+      throw Exception(path + " is corrupted.");
+    //no value can be larger than the file, the parameters of the layer must fit in what remains
+    for(eigen_size_t j = 0; j < 5; j++)
+      if(!(shape(0, j) >= (j < 3 ? 1 : 0) && shape(0, j) <= static_cast<double>(file.size())))
+        throw Exception(path + " is corrupted.");
+    if(!blockFits(offset, static_cast<uint64_t>(shape(0, 0)), static_cast<uint64_t>(shape(0, 1)), file.size()) ||
+       !blockFits(offset, static_cast<uint64_t>(shape(0, 0) * shape(0, 1)), static_cast<uint64_t>(shape(0, 2)) + 1, file.size()))
+      throw Exception(path + " is truncated.");
+    size_t size = static_cast<size_t>(shape(0, 0));
+    size_t k = static_cast<size_t>(shape(0, 1));
+    size_t inputs = static_cast<size_t>(shape(0, 2));
+    std::pair<size_t, size_t> functions(static_cast<size_t>(shape(0, 3)), static_cast<size_t>(shape(0, 4)));
+    if(aggregationMap.count(functions.first) == 0 || activationMap.count(functions.second) == 0)
+      throw Exception(path + " is corrupted.");
+    if(create)
+    {
+      LayerParam param;
+      param.size = size;
+      param.k = k;
+      addLayer(param, functions.first, functions.second);
+      _layers.back().init(inputs);
+    }
+    else if(_layers[i].size() != size || static_cast<size_t>(_layers[i].getWeights().rows()) != size * k ||
+            static_cast<size_t>(_layers[i].getWeights().cols()) != inputs || _layers[i].getFunctions() != functions)
+      throw Exception("The layer " + std::to_string(i) + " of " + path + " doesn't match the layer of the network.");
+    Vector aggregation = toVector(readBlock(file, offset, path));
+    Vector activation = toVector(readBlock(file, offset, path));
+    Eigen::Map<Matrix const> parameters = readBlock(file, offset, path);
+    if(parameters.rows() != 1 || static_cast<size_t>(parameters.cols()) != size * k * (inputs + 1))
+      throw Exception("The parameters of the layer " + std::to_string(i) + " of " + path + " don't match its shape.");
+    _layers[i].setParameters(Eigen::Map<Vector const>(parameters.data(), parameters.size()), aggregation, activation);
+  }
+}
+
+
+//everything needed to continue learning after epoch _epoch: the model, the seed (the data are split again from it),
+//the random generator, the histories, the training order, and all the tensors of the layers and of their replicas.
+//The file is written aside then renamed, the previous checkpoint stays valid if the process dies meanwhile
+void omnilearn::Network::saveCheckpoint(std::string const& path, double lowestLoss) const
+{
+  std::string const tmpPath = path + ".tmp";
+  {
+    std::ofstream file(tmpPath, std::ios::binary | std::ios::trunc);
+    if(!file)
+      throw Exception("Cannot open/create file " + tmpPath);
+    writeHeader(file, checkpointMagic, _param, _layers.size());
+    size_t offset = sizeof(OmnimodelHeader);
+    //the seed is split in two halves to be stored exactly
+    uint64_t seed = static_cast<uint64_t>(_seed);
+    writeBlock(file, offset, (Matrix(1, 7) << static_cast<double>(seed & 0xffffffff), static_cast<double>(seed >> 32), static_cast<double>(_epoch),
+                              static_cast<double>(_optimalEpoch), _param.learningRate, lowestLoss, static_cast<double>(_replicas.size())).finished());
+    writePreprocessBlocks(file, offset);
+    writeLayerBlocks(file, offset, false);
+
+    std::stringstream generator;
+    generator << _generator;
+    std::vector<double> words = parseNumbers(generator.str());
+    writeBlock(file, offset, words.data(), 1, words.size());
+    writeBlock(file, offset, _trainLosses.data(), 1, static_cast<size_t>(_trainLosses.size()));
+    writeBlock(file, offset, _validLosses.data(), 1, static_cast<size_t>(_validLosses.size()));
+    writeBlock(file, offset, _testMetric.data(), 1, static_cast<size_t>(_testMetric.size()));
+    writeBlock(file, offset, _testSecondMetric.data(), 1, static_cast<size_t>(_testSecondMetric.size()));
+    std::vector<double> order(_trainOrder.begin(), _trainOrder.end());
+    writeBlock(file, offset, order.data(), 1, order.size());
+
+    for(size_t r = 0; r <= _replicas.size(); r++)
+    {
+      std::vector<Layer> const& layers = (r == 0 ? _layers : _replicas[r-1]);
+      for(size_t i = 0; i < layers.size(); i++)
+      {
+        Eigen::Map<Vector const> arena = layers[i].getArena();
+        writeBlock(file, offset, arena.data(), 1, static_cast<size_t>(arena.size()));
+        writeBlock(file, offset, (Matrix(1, 1) << static_cast<double>(layers[i].getIteration())).finished());
+      }
+    }
+    if(!file)
+      throw Exception("Cannot write " + tmpPath + ".");
+  }
+  std::filesystem::rename(tmpPath, path);
+}
+
+
+//a checkpoint continues exactly where it has been written: the data are split again from the saved seed,
+//then the preprocessing, the layers, the optimizer state and the random generator are restored.
+//With warmStart, the model of a checkpoint or of an .omnimodel file starts a new training on the data of the network,
+//with its own split. The preprocessing of the file is kept, and the optimizer state if it is a checkpoint
+bool omnilearn::Network::resume(std::string const& path, bool warmStart)
+{
+  MappedFile file(path);
+  OmnimodelHeader header = readHeader(file, path);
+  bool checkpoint = (std::memcmp(header.magic, checkpointMagic, sizeof(header.magic)) == 0);
+  if(!checkpoint && !warmStart)
+    throw Exception(path + " has no training state, it can only be used to warm start.");
+  _param.inputReductionThreshold = header.inputReductionThreshold;
+  _param.inputWhiteningBias = header.inputWhiteningBias;
+  _param.outputReductionThreshold = header.outputReductionThreshold;
+  size_t offset = sizeof(header);
+
+  Vector state;
+  if(checkpoint)
+  {
+    state = toVector(readBlock(file, offset, path));
+    if(state.size() != 7)
+      throw Exception(path + " is corrupted.");
+  }
+  if(!warmStart)
+  {
+    _seed = static_cast<size_t>(static_cast<uint64_t>(state[0]) | (static_cast<uint64_t>(state[1]) << 32));
+    _generator = std::mt19937(_seed);
+  }
+  readPreprocessBlocks(file, offset, path);
+  //the layers are checked once initialized on the preprocessed data
+  checkPreprocessBlocks(path, static_cast<size_t>(sparseInputs() ? _sparseInputs.cols() : _inputs.cols()), static_cast<size_t>(_outputs.cols()));
+  prepareData(false);
+  initLearning();
+  readLayerBlocks(file, offset, path, header.layers, false);
+  //replicas are copied again from the restored layers
+  if(!_replicas.empty())
+    _replicas = std::vector<std::vector<Layer>>(_replicas.size(), _layers);
+
+  if(checkpoint)
+  {
+    Eigen::Map<Matrix const> words = readBlock(file, offset, path);
+    Vector trainLosses = toVector(readBlock(file, offset, path));
+    Vector validLosses = toVector(readBlock(file, offset, path));
+    Vector testMetric = toVector(readBlock(file, offset, path));
+    Vector testSecondMetric = toVector(readBlock(file, offset, path));
+    Eigen::Map<Matrix const> order = readBlock(file, offset, path);
+
+    //the replicas of the checkpoint are restored only if the network has as many
+    size_t replicas = static_cast<size_t>(state[6]);
+    for(size_t r = 0; r <= replicas; r++)
+    {
+      for(size_t i = 0; i < _layers.size(); i++)
+      {
+        Eigen::Map<Matrix const> arena = readBlock(file, offset, path);
+        size_t iteration = static_cast<size_t>(readBlock(file, offset, path)(0, 0));
+        if(r == 0)
+          _layers[i].setArena(Eigen::Map<Vector const>(arena.data(), arena.size()), iteration);
+        else if(replicas == _replicas.size())
+          _replicas[r-1][i].setArena(Eigen::Map<Vector const>(arena.data(), arena.size()), iteration);
+      }
+    }
+
+    if(!warmStart)
+    {
+      if(static_cast<size_t>(order.size()) != _trainOrder.size())
+        throw Exception("The data of the network don't match the data of " + path + ".");
+      std::string text;
+      for(eigen_size_t i = 0; i < words.size(); i++)
+        text += std::to_string(static_cast<uint64_t>(words.data()[i])) + " ";
+      std::istringstream generator(text);
+      generator >> _generator;
+      _trainLosses = trainLosses;
+      _validLosses = validLosses;
+      _testMetric = testMetric;
+      _testSecondMetric = testSecondMetric;
+      for(size_t i = 0; i < _trainOrder.size(); i++)
+        _trainOrder[i] = static_cast<size_t>(order.data()[i]);
+      _epoch = static_cast<size_t>(state[2]);
+      _optimalEpoch = static_cast<size_t>(state[3]);
+      _param.learningRate = state[4];
+      std::cout << "\nResumed after epoch " << _epoch << "\n";
+      return train(_epoch + 1, state[5]);
+    }
+  }
+
+  double lowestLoss = computeLoss();
+  std::cout << "\n";
+  return train(1, lowestLoss);
+}
+
+
+omnilearn::Vector omnilearn::Network::generate(NetworkParam param, Vector target, Vector input)
+{
+  if(input.size() == 0)
+  {
+
+  }
+  for(size_t iteration = 0; iteration < param.epoch; iteration++)
+  {
+    Vector res = input;
+    for(size_t i = 0; i < _layers.size(); i++)
+    {
+      res = _layers[i].processToLearn(res, param.dropout, param.dropconnect, _dropoutDist, _dropconnectDist, _generator, _pool);
+    }
+
+    Vector gradients(computeGradVector(target, res));
+    for(size_t i = 0; i < _layers.size() - 1; i++)
+    {
+      _layers[_layers.size() - i - 1].computeGradients(gradients, _pool);
+      gradients = _layers[_layers.size() - i - 1].getGradients(_pool);
+    }
+    _layers[0].computeGradientsAccordingToInputs(gradients, _pool);
+    gradients = _layers[0].getGradients(_pool);
+    //_layers[0].updateInputs(input, gradients, _pool);
+  }
+  return Vector();
+}
+
+
+void omnilearn::Network::initLayers()
+{
+  for(size_t i = 0; i < _layers.size(); i++)
+  {
+      _layers[i].init((i == 0 ? static_cast<size_t>(sparseInputs() ? _sparseInputs.cols() : _inputs.cols()) : _layers[i-1].size()),
+                      (i == _layers.size()-1 ? 0 : _layers[i+1].size()),
+                      _generator);
+  }
+  _replicas.clear();
+  if(_param.parallelism != Parallelism::Layer && _param.threads > 1)
+    _replicas = std::vector<std::vector<Layer>>(_param.threads, _layers);
+}
+
+
+//only the order of the training features changes, batches are gathered through it
+void omnilearn::Network::shuffleTrainData()
+{
+  std::shuffle(_trainOrder.begin(), _trainOrder.end(), _generator);
+}
+
+
+//new row i is the old row order[i], rows are moved along the cycles of the permutation
+static void permuteRows(omnilearn::Matrix& data, std::vector<size_t> const& order)
+{
+  std::vector<bool> moved(order.size(), false);
+  omnilearn::rowVector temp;
+  for(size_t i = 0; i < order.size(); i++)
+  {
+    if(moved[i] || order[i] == i)
+      continue;
+    temp = data.row(static_cast<eigen_size_t>(i));
+    size_t j = i;
+    while(order[j] != i)
     {
-      if(reduced == true)
-        throw Exception("Inputs are reduced multiple times.");
-      reduce(_trainInputs, _inputDecorrelation, _param.inputReductionThreshold);
-      reduce(_validationInputs, _inputDecorrelation, _param.inputReductionThreshold);
-      reduce(_testInputs, _inputDecorrelation, _param.inputReductionThreshold);
-      reduced = true;
+      data.row(static_cast<eigen_size_t>(j)) = data.row(static_cast<eigen_size_t>(order[j]));
+      moved[j] = true;
+      j = order[j];
     }
+    data.row(static_cast<eigen_size_t>(j)) = temp;
+    moved[j] = true;
   }
+}
 
-  centered = false;
-  normalized = false;
-  standardized = false;
-  decorrelated = false;
-  whitened = false;
-  reduced = false;
 
+//copies the given rows of data in target, in the given order
+static void gatherRows(omnilearn::SparseMatrix const& data, size_t const* rows, size_t count, omnilearn::SparseMatrix& target)
+{
+  eigen_size_t nonZeros = 0;
+  for(size_t i = 0; i < count; i++)
+    nonZeros += data.innerVector(static_cast<eigen_size_t>(rows[i])).nonZeros();
+  target.resize(static_cast<eigen_size_t>(count), data.cols());
+  target.reserve(nonZeros);
+  for(size_t i = 0; i < count; i++)
+  {
+    target.startVec(static_cast<eigen_size_t>(i));
+    for(omnilearn::SparseMatrix::InnerIterator it(data, static_cast<eigen_size_t>(rows[i])); it; ++it)
+      target.insertBack(static_cast<eigen_size_t>(i), it.col()) = it.value();
+  }
+  target.finalize();
+}
+
+
+//features are put in a random order once, in place. Then the training features are the first
+//rows of the data, followed by the validation features. Test features are moved out, they stay raw
+void omnilearn::Network::shuffleData()
+{
+  if(_testRawOutputs.rows() != 0 && std::abs(_param.testRatio) > std::numeric_limits<double>::epsilon())
+    throw Exception("TestRatio must be set to 0 because you already set a test dataset.");
+
+  size_t rows = static_cast<size_t>(_outputs.rows());
+  double validation = _param.validationRatio * static_cast<double>(rows);
+  double test = _param.testRatio * static_cast<double>(rows);
+  double nbBatch = std::trunc(static_cast<double>(rows) - validation - test) / static_cast<double>(_param.batchSize);
+  if(_param.batchSize == 0)
+    nbBatch = 1; // if batch size == 0, then is batch gradient descend
+
+  //add a batch if an incomplete batch has more than 0.5*batchsize data
+  if(nbBatch - std::trunc(nbBatch) >= 0.5)
+    nbBatch = std::trunc(nbBatch) + 1;
+
+  //the rounded up batches can't take more features than there are, and the three sets add up to rows.
+  //A single batch takes what the ratios leave
+  size_t trainRows = static_cast<size_t>(std::max(0.0, std::trunc(static_cast<double>(rows) - validation - test)));
+  if(_param.batchSize != 0)
+    trainRows = std::min(rows, static_cast<size_t>(nbBatch)*_param.batchSize);
+  size_t noTrain = rows - trainRows;
+  double ratios = _param.validationRatio + _param.testRatio;
+  size_t nbValidation = (ratios > 0 ? static_cast<size_t>(std::round(static_cast<double>(noTrain)*_param.validationRatio/ratios)) : 0);
+  size_t nbTest = noTrain - nbValidation;
+  size_t nbTrain = rows - noTrain;
+
+  //validation and test features are taken from the end of the shuffled features
+  std::vector<size_t> indexes(rows, 0);
+  std::iota(indexes.begin(), indexes.end(), 0);
+  std::shuffle(indexes.begin(), indexes.end(), _generator);
+  std::vector<size_t> order(indexes.begin(), indexes.begin() + static_cast<std::ptrdiff_t>(nbTrain));
+  for(size_t i = 0; i < nbValidation + nbTest; i++)
+    order.push_back(indexes[rows-1-i]);
+  permuteRows(_outputs, order);
+  bool testSet = (_testRawOutputs.rows() != 0);
+  if(sparseInputs())
+  {
+    //sparse rows are rebuilt in the new order, without the test features
+    SparseMatrix permuted;
+    gatherRows(_sparseInputs, order.data(), nbTrain + nbValidation, permuted);
+    if(!testSet)
+      gatherRows(_sparseInputs, order.data() + nbTrain + nbValidation, nbTest, _testRawSparseInputs);
+    _sparseInputs = std::move(permuted);
+  }
+  else
+  {
+    permuteRows(_inputs, order);
+    if(!testSet)
+      _testRawInputs = _inputs.bottomRows(static_cast<eigen_size_t>(nbTest));
+    _inputs.conservativeResize(static_cast<eigen_size_t>(nbTrain + nbValidation), Eigen::NoChange);
+  }
+  if(!testSet)
+    _testRawOutputs = _outputs.bottomRows(static_cast<eigen_size_t>(nbTest));
+  _outputs.conservativeResize(static_cast<eigen_size_t>(nbTrain + nbValidation), Eigen::NoChange);
+
+  _nbBatch = (_param.batchSize == 0 ? 1 : (nbTrain + _param.batchSize - 1) / _param.batchSize);
+  _trainSize = nbTrain;
+  _validationSize = nbValidation;
+  _trainOrder = std::vector<size_t>(nbTrain);
+  std::iota(_trainOrder.begin(), _trainOrder.end(), 0);
+}
+
+
+//statistics are computed on the training features, then each step is applied to all the data
+void omnilearn::Network::preprocess(bool statistics)
+{
+  checkPreprocess(_param.preprocessInputs, false);
+  checkPreprocess(_param.preprocessOutputs, true);
+  if(sparseInputs() && !_param.preprocessInputs.empty())
+    throw Exception("Inputs can't be preprocessed when they are sparse, they would become dense.");
+  eigen_size_t nbTrain = static_cast<eigen_size_t>(_trainSize);
+
+  for(size_t i = 0; i < _param.preprocessInputs.size(); i++)
+  {
+    if(statistics && needsStatistics(_param.preprocessInputs[i]))
+    {
+      StreamingStats stats(static_cast<size_t>(_inputs.cols()), _param.preprocessInputs[i] == Preprocess::Decorrelate);
+      stats.add(_inputs.topRows(nbTrain));
+      setInputPreprocess(i, stats);
+    }
+    preprocessInputs(_inputs, i, i+1);
+  }
   for(size_t i = 0; i < _param.preprocessOutputs.size(); i++)
+  {
+    if(statistics && needsStatistics(_param.preprocessOutputs[i]))
+    {
+      StreamingStats stats(static_cast<size_t>(_outputs.cols()), _param.preprocessOutputs[i] == Preprocess::Decorrelate);
+      stats.add(_outputs.topRows(nbTrain));
+      setOutputPreprocess(i, stats);
+    }
+    preprocessOutputs(_outputs, i, i+1);
+  }
+}
+
+
+//throws if a preprocessing step is used several times, or can't be used on outputs
+void omnilearn::Network::checkPreprocess(std::vector<Preprocess> const& steps, bool outputs)
+{
+  for(size_t i = 0; i < steps.size(); i++)
+  {
+    if(std::find(steps.begin() + static_cast<std::ptrdiff_t>(i) + 1, steps.end(), steps[i]) != steps.end())
+      throw Exception((outputs ? "Outputs" : "Inputs") + std::string(" are preprocessed multiple times with the same method."));
+    if(outputs && steps[i] == Preprocess::Whiten)
+      throw Exception("Outputs can't be whitened.");
+    if(outputs && steps[i] == Preprocess::Standardize)
+      throw Exception("Outputs can't be standardized.");
+  }
+}
+
+
+bool omnilearn::Network::needsStatistics(Preprocess step)
+{
+  return step != Preprocess::Whiten && step != Preprocess::Reduce;
+}
+
+
+//sets the parameters of a step from the statistics of data preprocessed by the previous steps
+void omnilearn::Network::setInputPreprocess(size_t step, StreamingStats const& stats)
+{
+  if(_param.preprocessInputs[step] == Preprocess::Center)
+    _inputCenter = stats.mean();
+  else if(_param.preprocessInputs[step] == Preprocess::Normalize)
+    _inputNormalization = stats.minMax();
+  else if(_param.preprocessInputs[step] == Preprocess::Standardize)
+    _inputStandartization = stats.meanDev();
+  else if(_param.preprocessInputs[step] == Preprocess::Decorrelate)
+    _inputDecorrelation = stats.decorrelation();
+}
+
+
+void omnilearn::Network::setOutputPreprocess(size_t step, StreamingStats const& stats)
+{
+  if(_param.preprocessOutputs[step] == Preprocess::Center)
+    _outputCenter = stats.mean();
+  else if(_param.preprocessOutputs[step] == Preprocess::Normalize)
+    _outputNormalization = stats.minMax();
+  else if(_param.preprocessOutputs[step] == Preprocess::Decorrelate)
+    _outputDecorrelation = stats.decorrelation();
+}
+
+
+//validation and test features are drawn in a reservoir of bounded size, they are the only
+//features kept in memory. Each preprocessing step needing statistics takes one pass over
+//the training features, preprocessed by the previous steps
+void omnilearn::Network::initStream(bool statistics)
+{
+  if(_param.parallelism == Parallelism::Hogwild && _param.threads > 1)
+    throw Exception("Hogwild parallelism can't be used with a streaming data source.");
+  if(_testRawInputs.rows() != 0 && std::abs(_param.testRatio) > std::numeric_limits<double>::epsilon())
+    throw Exception("TestRatio must be set to 0 because you already set a test dataset.");
+  checkPreprocess(_param.preprocessInputs, false);
+  checkPreprocess(_param.preprocessOutputs, true);
+
+  size_t size = _source->size();
+  size_t validation = std::min(_param.streamReservoir, static_cast<size_t>(std::round(_param.validationRatio * static_cast<double>(size))));
+  size_t test = std::min(_param.streamReservoir, static_cast<size_t>(std::round(_param.testRatio * static_cast<double>(size))));
+  if(validation + test >= size)
+    throw Exception("The source doesn't have enough features for the validation and test sets.");
+
+  //reservoir sampling of the held-out features, then split between validation and test
+  std::vector<size_t> reservoir(validation + test);
+  std::iota(reservoir.begin(), reservoir.end(), 0);
+  for(size_t i = reservoir.size(); i < size && !reservoir.empty(); i++)
+  {
+    size_t j = std::uniform_int_distribution<size_t>(0, i)(_generator);
+    if(j < reservoir.size())
+      reservoir[j] = i;
+  }
+  std::shuffle(reservoir.begin(), reservoir.end(), _generator);
+
+  eigen_size_t inputCols = static_cast<eigen_size_t>(_inputLabels.size());
+  eigen_size_t outputCols = static_cast<eigen_size_t>(_outputLabels.size());
+  //only the validation features are in the data, training features are streamed
+  _inputs = Matrix(static_cast<eigen_size_t>(validation), inputCols);
+  _outputs = Matrix(static_cast<eigen_size_t>(validation), outputCols);
+  if(_testRawInputs.rows() == 0)
+  {
+    _testRawInputs = Matrix(static_cast<eigen_size_t>(test), inputCols);
+    _testRawOutputs = Matrix(static_cast<eigen_size_t>(test), outputCols);
+  }
+
+  //features of the same block are read at once
+  std::vector<std::pair<size_t, size_t>> order(reservoir.size());
+  for(size_t i = 0; i < reservoir.size(); i++)
+    order[i] = {reservoir[i], i};
+  std::sort(order.begin(), order.end());
+  size_t blockSize = std::max(static_cast<size_t>(1), _param.streamBlockSize);
+  Matrix inputs;
+  Matrix outputs;
+  for(size_t i = 0, j = 0; i < order.size(); i = j)
+  {
+    while(j < order.size() && order[j].first / blockSize == order[i].first / blockSize)
+      j++;
+    _source->read(order[i].first, order[j-1].first - order[i].first + 1, inputs, outputs);
+    for(size_t k = i; k < j; k++)
+    {
+      eigen_size_t row = static_cast<eigen_size_t>(order[k].first - order[i].first);
+      eigen_size_t slot = static_cast<eigen_size_t>(order[k].second);
+      Matrix& heldInputs = (order[k].second < validation ? _inputs : _testRawInputs);
+      Matrix& heldOutputs = (order[k].second < validation ? _outputs : _testRawOutputs);
+      slot = (order[k].second < validation ? slot : slot - static_cast<eigen_size_t>(validation));
+      heldInputs.row(slot) = inputs.row(row);
+      heldOutputs.row(slot) = outputs.row(row);
+    }
+  }
+  _heldOut = reservoir;
+  std::sort(_heldOut.begin(), _heldOut.end());
+  _trainSize = size - reservoir.size();
+  _validationSize = validation;
+
+  //statistics of each step, on data preprocessed by the previous ones
+  std::vector<size_t> blocks = streamBlocks();
+  for(size_t i = 0; i < _param.preprocessInputs.size() && statistics; i++)
+  {
+    if(!needsStatistics(_param.preprocessInputs[i]))
+      continue;
+    //number of columns after the previous steps
+    Matrix columns(0, inputCols);
+    preprocessInputs(columns, 0, i);
+    StreamingStats stats(static_cast<size_t>(columns.cols()), _param.preprocessInputs[i] == Preprocess::Decorrelate);
+    streamTrainData(blocks, i, 0, [&stats](Matrix& chunk, Matrix&)->void{ stats.add(chunk); });
+    setInputPreprocess(i, stats);
+  }
+  for(size_t i = 0; i < _param.preprocessOutputs.size() && statistics; i++)
+  {
+    if(!needsStatistics(_param.preprocessOutputs[i]))
+      continue;
+    Matrix columns(0, outputCols);
+    preprocessOutputs(columns, 0, i);
+    StreamingStats stats(static_cast<size_t>(columns.cols()), _param.preprocessOutputs[i] == Preprocess::Decorrelate);
+    streamTrainData(blocks, 0, i, [&stats](Matrix&, Matrix& chunk)->void{ stats.add(chunk); });
+    setOutputPreprocess(i, stats);
+  }
+  preprocessInputs(_inputs, 0, _param.preprocessInputs.size());
+  preprocessOutputs(_outputs, 0, _param.preprocessOutputs.size());
+}
+
+
+void omnilearn::Network::preprocessInputs(Matrix& inputs, size_t first, size_t last) const
+{
+  for(size_t i = first; i < last; i++)
+  {
+    if(_param.preprocessInputs[i] == Preprocess::Center)
+    {
+      center(inputs, _inputCenter);
+    }
+    else if(_param.preprocessInputs[i] == Preprocess::Normalize)
+    {
+      normalize(inputs, _inputNormalization);
+    }
+    else if(_param.preprocessInputs[i] == Preprocess::Standardize)
+    {
+      standardize(inputs, _inputStandartization);
+    }
+    else if(_param.preprocessInputs[i] == Preprocess::Decorrelate)
+    {
+      decorrelate(inputs, _inputDecorrelation);
+    }
+    else if(_param.preprocessInputs[i] == Preprocess::Whiten)
+    {
+      whiten(inputs, _inputDecorrelation, _param.inputWhiteningBias);
+    }
+    else if(_param.preprocessInputs[i] == Preprocess::Reduce)
+    {
+      reduce(inputs, _inputDecorrelation, _param.inputReductionThreshold);
+    }
+  }
+}
+
+
+void omnilearn::Network::preprocessOutputs(Matrix& outputs, size_t first, size_t last) const
+{
+  for(size_t i = first; i < last; i++)
   {
     if(_param.preprocessOutputs[i] == Preprocess::Center)
     {
-      if(centered == true)
-        throw Exception("Outputs are centered multiple times.");
-      _outputCenter = center(_trainOutputs);
-      center(_validationOutputs, _outputCenter);
-      center(_testOutputs, _outputCenter);
-      centered = true;
+      center(outputs, _outputCenter);
     }
     else if(_param.preprocessOutputs[i] == Preprocess::Decorrelate)
     {
-      if(decorrelated == true)
-        throw Exception("Outputs are decorrelated multiple times.");
-      _outputDecorrelation = decorrelate(_trainOutputs);
-      decorrelate(_validationOutputs, _outputDecorrelation);
-      decorrelate(_testOutputs, _outputDecorrelation);
-      decorrelated = true;
+      decorrelate(outputs, _outputDecorrelation);
     }
     else if(_param.preprocessOutputs[i] == Preprocess::Reduce)
     {
-      if(reduced == true)
-        throw Exception("Outputs are reduced multiple times.");
-      reduce(_trainOutputs, _outputDecorrelation, _param.outputReductionThreshold);
-      reduce(_validationOutputs, _outputDecorrelation, _param.outputReductionThreshold);
-      reduce(_testOutputs, _outputDecorrelation, _param.outputReductionThreshold);
-      reduced = true;
+      reduce(outputs, _outputDecorrelation, _param.outputReductionThreshold);
     }
     else if(_param.preprocessOutputs[i] == Preprocess::Normalize)
     {
-      if(normalized == true)
-        throw Exception("Outputs are normalized multiple times.");
-      _outputNormalization = normalize(_trainOutputs);
-      normalize(_validationOutputs, _outputNormalization);
-      normalize(_testOutputs, _outputNormalization);
-      normalized = true;
+      normalize(outputs, _outputNormalization);
+    }
+  }
+}
+
+
+void omnilearn::Network::performeOneEpoch()
+{
+  //if batch size == 0, then is batch gradient descend
+  eigen_size_t batchSize = (_param.batchSize == 0 ? static_cast<eigen_size_t>(_trainSize) : std::min(static_cast<eigen_size_t>(_param.batchSize), static_cast<eigen_size_t>(_trainSize)));
+
+  double lr = _param.learningRate;
+  //plateau decay is taken into account in learn()
+  if(_param.decay == Decay::Inverse)
+    lr = inverse(_param.learningRate, _epoch, _param.decayValue);
+  else if(_param.decay == Decay::Exp)
+    lr = exp(_param.learningRate, _epoch, _param.decayValue);
+  else if(_param.decay == Decay::Step)
+    lr = step(_param.learningRate, _epoch, _param.decayValue, _param.decayDelay);
+
+  if(_source)
+  {
+    performeStreamingEpoch(lr);
+    return;
+  }
+  if(_param.parallelism == Parallelism::Hogwild && !_replicas.empty())
+  {
+    performeHogwildEpoch(batchSize, lr);
+    return;
+  }
+
+  //the next batches are gathered in background, in reused buffers
+  size_t next = 0;
+  Prefetcher prefetcher(_param.prefetchDepth, [this, &next, batchSize](Prefetcher::Batch& batch)->bool
+  {
+    if(next >= _nbBatch)
+      return false;
+    gatherBatch(next++, batchSize, batch);
+    return true;
+  });
+  for(Prefetcher::Batch* batch = prefetcher.next(); batch != nullptr; batch = prefetcher.next())
+  {
+    //the whole batch goes through the network at once, one line per feature
+    if(sparseInputs())
+      accumulateGradients(batch->sparseInputs, batch->outputs);
+    else
+      accumulateGradients(batch->inputs, batch->outputs);
+    updateLayers(lr);
+  }
+}
+
+
+//each thread takes the next batch, learns it on its replica and pushes the update
+//to the shared layers without any lock. Replicas keep their own optimizer state
+void omnilearn::Network::performeHogwildEpoch(eigen_size_t batchSize, double lr)
+{
+  waitSnapshot(false);
+  std::atomic<size_t> nextBatch(0);
+  std::vector<std::mt19937::result_type> seeds(_replicas.size());
+  for(size_t r = 0; r < seeds.size(); r++)
+    seeds[r] = _generator();
+
+  _pool.parallel_for(0, _replicas.size(), 1, [this, &nextBatch, &seeds, batchSize, lr](size_t begin, size_t end)->void
+  {
+    for(size_t r = begin; r < end; r++)
+    {
+      std::mt19937 generator(seeds[r]);
+      std::bernoulli_distribution dropoutDist(_param.dropout);
+      std::bernoulli_distribution dropconnectDist(_param.dropconnect);
+      Prefetcher::Batch data;
+      for(size_t batch = nextBatch++; batch < _nbBatch; batch = nextBatch++)
+      {
+        for(size_t i = 0; i < _layers.size(); i++)
+          _replicas[r][i].pullParameters(_layers[i]);
+        gatherBatch(batch, batchSize, data);
+        if(sparseInputs())
+          backpropagate(_replicas[r], data.sparseInputs, data.outputs, generator, dropoutDist, dropconnectDist, _serialPool);
+        else
+          backpropagate(_replicas[r], data.inputs, data.outputs, generator, dropoutDist, dropconnectDist, _serialPool);
+        for(size_t i = 0; i < _layers.size(); i++)
+        {
+          _replicas[r][i].updateWeights(lr, _param.L1, _param.L2, _param.optimizer, _param.momentum, optimizerWindow(), _param.optimizerBias, _serialPool);
+          _replicas[r][i].pushParameters(_layers[i]);
+        }
+      }
     }
-    else if(_param.preprocessOutputs[i] == Preprocess::Whiten)
+  });
+}
+
+
+void omnilearn::Network::gatherBatch(size_t batch, eigen_size_t batchSize, Prefetcher::Batch& data) const
+{
+  size_t const* rows = _trainOrder.data() + batch * static_cast<size_t>(batchSize);
+  //the last batch is shorter if the training features don't fill it
+  batchSize = std::min(batchSize, static_cast<eigen_size_t>(_trainSize - batch * static_cast<size_t>(batchSize)));
+  if(sparseInputs())
+    gatherRows(_sparseInputs, rows, static_cast<size_t>(batchSize), data.sparseInputs);
+  else
+    data.inputs.resize(batchSize, _inputs.cols());
+  data.outputs.resize(batchSize, _outputs.cols());
+  for(eigen_size_t i = 0; i < batchSize; i++)
+  {
+    eigen_size_t row = static_cast<eigen_size_t>(rows[i]);
+    if(!sparseInputs())
+      data.inputs.row(i) = _inputs.row(row);
+    data.outputs.row(i) = _outputs.row(row);
+  }
+}
+
+
+//features are read block by block in a random order, and mixed within windows of
+//streamShuffleBlocks blocks. Features left at the end of a window go to the next one
+void omnilearn::Network::performeStreamingEpoch(double lr)
+{
+  std::vector<size_t> blocks = streamBlocks();
+  std::shuffle(blocks.begin(), blocks.end(), _generator);
+  eigen_size_t batchSize = static_cast<eigen_size_t>(_param.batchSize);
+  Matrix inputs(0, _inputs.cols());
+  Matrix outputs(0, _outputs.cols());
+
+  streamTrainData(blocks, _param.preprocessInputs.size(), _param.preprocessOutputs.size(), [this, &inputs, &outputs, batchSize, lr](Matrix& windowInputs, Matrix& windowOutputs)->void
+  {
+    //if batch size == 0, then is batch gradient descend: gradients are accumulated over the whole epoch
+    if(batchSize == 0)
     {
-      throw Exception("Outputs can't be whitened.");
+      accumulateGradients(windowInputs, windowOutputs);
+      return;
     }
-    else if(_param.preprocessOutputs[i] == Preprocess::Standardize)
+    std::vector<eigen_size_t> indexes(static_cast<size_t>(windowInputs.rows()));
+    std::iota(indexes.begin(), indexes.end(), 0);
+    std::shuffle(indexes.begin(), indexes.end(), _generator);
+
+    eigen_size_t left = inputs.rows();
+    inputs.conservativeResize(left + windowInputs.rows(), Eigen::NoChange);
+    outputs.conservativeResize(left + windowOutputs.rows(), Eigen::NoChange);
+    for(size_t i = 0; i < indexes.size(); i++)
     {
-      throw Exception("Outputs can't be standardized.");
+      inputs.row(left + static_cast<eigen_size_t>(i)) = windowInputs.row(indexes[i]);
+      outputs.row(left + static_cast<eigen_size_t>(i)) = windowOutputs.row(indexes[i]);
     }
-  }
+
+    eigen_size_t nbBatch = inputs.rows() / batchSize;
+    for(eigen_size_t batch = 0; batch < nbBatch; batch++)
+    {
+      accumulateGradients(Matrix(inputs.middleRows(batch*batchSize, batchSize)), outputs.middleRows(batch*batchSize, batchSize));
+      updateLayers(lr);
+    }
+    inputs = Matrix(inputs.bottomRows(inputs.rows() - nbBatch*batchSize));
+    outputs = Matrix(outputs.bottomRows(outputs.rows() - nbBatch*batchSize));
+  });
+
+  //add a batch if an incomplete batch has more than 0.5*batchsize data
+  if(batchSize != 0 && inputs.rows() != 0 && 2*inputs.rows() >= batchSize)
+    accumulateGradients(inputs, outputs);
+  if(batchSize == 0 || (inputs.rows() != 0 && 2*inputs.rows() >= batchSize))
+    updateLayers(lr);
 }
 
 
-void omnilearn::Network::performeOneEpoch()
+std::vector<size_t> omnilearn::Network::streamBlocks() const
 {
-  for(size_t batch = 0; batch < _nbBatch; batch++)
+  size_t blockSize = std::max(static_cast<size_t>(1), _param.streamBlockSize);
+  std::vector<size_t> blocks((_source->size() + blockSize - 1) / blockSize);
+  std::iota(blocks.begin(), blocks.end(), 0);
+  return blocks;
+}
+
+
+void omnilearn::Network::readTrainWindow(std::vector<size_t> const& blocks, size_t first, size_t inputSteps, size_t outputSteps, Matrix& inputs, Matrix& outputs) const
+{
+  size_t blockSize = std::max(static_cast<size_t>(1), _param.streamBlockSize);
+  size_t count = std::min(std::max(static_cast<size_t>(1), _param.streamShuffleBlocks), blocks.size() - first);
+  std::vector<Matrix> blockInputs(count);
+  std::vector<Matrix> blockOutputs(count);
+
+  //the blocks of a window are read, filtered and preprocessed in parallel
+  _pool.parallel_for(0, count, 1, [this, &blocks, &blockInputs, &blockOutputs, first, blockSize, inputSteps, outputSteps](size_t begin, size_t end)->void
   {
-    for(size_t feature = 0; feature < _param.batchSize; feature++)
+    for(size_t b = begin; b < end; b++)
     {
-      Vector featureInput = _trainInputs.row(batch*_param.batchSize + feature);
-      Vector featureOutput = _trainOutputs.row(batch*_param.batchSize + feature);
+      size_t firstFeature = blocks[first + b] * blockSize;
+      size_t lastFeature = std::min(_source->size(), firstFeature + blockSize);
+      _source->read(firstFeature, lastFeature - firstFeature, blockInputs[b], blockOutputs[b]);
 
-      for(size_t i = 0; i < _layers.size(); i++)
+      //remove validation and test features
+      std::vector<size_t>::const_iterator heldOut = std::lower_bound(_heldOut.begin(), _heldOut.end(), firstFeature);
+      if(heldOut != _heldOut.end() && *heldOut < lastFeature)
       {
-        featureInput = _layers[i].processToLearn(featureInput, _param.dropout, _param.dropconnect, _dropoutDist, _dropconnectDist, _generator, _pool);
+        eigen_size_t kept = 0;
+        for(size_t i = firstFeature; i < lastFeature; i++)
+        {
+          if(heldOut != _heldOut.end() && *heldOut == i)
+          {
+            heldOut++;
+            continue;
+          }
+          blockInputs[b].row(kept) = blockInputs[b].row(static_cast<eigen_size_t>(i - firstFeature));
+          blockOutputs[b].row(kept) = blockOutputs[b].row(static_cast<eigen_size_t>(i - firstFeature));
+          kept++;
+        }
+        blockInputs[b].conservativeResize(kept, Eigen::NoChange);
+        blockOutputs[b].conservativeResize(kept, Eigen::NoChange);
       }
+      preprocessInputs(blockInputs[b], 0, inputSteps);
+      preprocessOutputs(blockOutputs[b], 0, outputSteps);
+    }
+  });
+
+  eigen_size_t rows = 0;
+  for(size_t b = 0; b < count; b++)
+    rows += blockInputs[b].rows();
+  inputs.resize(rows, blockInputs[0].cols());
+  outputs.resize(rows, blockOutputs[0].cols());
+  rows = 0;
+  for(size_t b = 0; b < count; b++)
+  {
+    inputs.middleRows(rows, blockInputs[b].rows()) = blockInputs[b];
+    outputs.middleRows(rows, blockOutputs[b].rows()) = blockOutputs[b];
+    rows += blockInputs[b].rows();
+  }
+}
 
-      Vector gradients(computeGradVector(featureOutput, featureInput));
-      for(size_t i = 0; i < _layers.size(); i++)
+
+void omnilearn::Network::streamTrainData(std::vector<size_t> const& blocks, size_t inputSteps, size_t outputSteps, std::function<void(Matrix&, Matrix&)> const& func) const
+{
+  size_t window = std::max(static_cast<size_t>(1), _param.streamShuffleBlocks);
+  size_t first = 0;
+  Prefetcher prefetcher(_param.prefetchDepth, [this, &blocks, &first, window, inputSteps, outputSteps](Prefetcher::Batch& batch)->bool
+  {
+    //windows whose features are all held out are skipped
+    for(; first < blocks.size(); first += window)
+    {
+      readTrainWindow(blocks, first, inputSteps, outputSteps, batch.inputs, batch.outputs);
+      if(batch.inputs.rows() != 0)
       {
-        _layers[_layers.size() - i - 1].computeGradients(gradients, _pool);
-        gradients = _layers[_layers.size() - i - 1].getGradients(_pool);
+        first += window;
+        return true;
       }
     }
+    return false;
+  });
+  for(Prefetcher::Batch* batch = prefetcher.next(); batch != nullptr; batch = prefetcher.next())
+    func(batch->inputs, batch->outputs);
+}
 
-    double lr = _param.learningRate;
-    //plateau decay is taken into account in learn()
-    if(_param.decay == Decay::Inverse)
-      lr = inverse(_param.learningRate, _epoch, _param.decayValue);
-    else if(_param.decay == Decay::Exp)
-      lr = exp(_param.learningRate, _epoch, _param.decayValue);
-    else if(_param.decay == Decay::Step)
-      lr = step(_param.learningRate, _epoch, _param.decayValue, _param.decayDelay);
 
-    for(size_t i = 0; i < _layers.size(); i++)
+//inputs are a Matrix or a SparseMatrix
+template<typename Inputs>
+void omnilearn::Network::accumulateGradients(Inputs const& input, Matrix const& output)
+{
+  eigen_size_t batchSize = input.rows();
+  if(_replicas.empty())
+  {
+    backpropagate(_layers, input, output, _generator, _dropoutDist, _dropconnectDist, _pool);
+  }
+  else
+  {
+    //each replica takes a slice of the batch, with its own dropout generator
+    eigen_size_t nbReplicas = static_cast<eigen_size_t>(_replicas.size());
+    eigen_size_t sliceSize = (batchSize + nbReplicas - 1) / nbReplicas;
+    std::vector<std::mt19937::result_type> seeds(_replicas.size());
+    for(size_t r = 0; r < seeds.size(); r++)
+      seeds[r] = _generator();
+
+    _pool.parallel_for(0, _replicas.size(), 1, [this, &input, &output, &seeds, batchSize, sliceSize](size_t begin, size_t end)->void
     {
-      _layers[i].updateWeights(lr, _param.L1, _param.L2, _param.optimizer, _param.momentum, _param.window, _param.optimizerBias, _pool);
-    }
+      for(size_t r = begin; r < end; r++)
+      {
+        eigen_size_t first = static_cast<eigen_size_t>(r) * sliceSize;
+        if(first >= batchSize)
+          continue;
+        eigen_size_t count = std::min(sliceSize, batchSize - first);
+        //replicas read the parameters of the layers, which don't change until all the slices are done
+        for(size_t i = 0; i < _layers.size(); i++)
+          _replicas[r][i].shareParameters(&_layers[i]);
+        std::mt19937 generator(seeds[r]);
+        std::bernoulli_distribution dropoutDist(_param.dropout);
+        std::bernoulli_distribution dropconnectDist(_param.dropconnect);
+        backpropagate(_replicas[r], Inputs(input.middleRows(first, count)), output.middleRows(first, count), generator, dropoutDist, dropconnectDist, _serialPool);
+      }
+    });
+
+    //all-reduce, replicas are summed in a fixed order
+    _pool.parallel_for(0, _layers.size(), 1, [this](size_t begin, size_t end)->void
+    {
+      for(size_t i = begin; i < end; i++)
+        for(size_t r = 0; r < _replicas.size(); r++)
+          _layers[i].mergeGradients(_replicas[r][i]);
+    });
   }
 }
 
 
-//process taking already processed inputs and giving processed outputs
-omnilearn::Matrix omnilearn::Network::processForLoss(Matrix inputs) const
+void omnilearn::Network::updateLayers(double lr)
 {
+  waitSnapshot(false);
   for(size_t i = 0; i < _layers.size(); i++)
+  {
+    _layers[i].updateWeights(lr, _param.L1, _param.L2, _param.optimizer, _param.momentum, optimizerWindow(), _param.optimizerBias, _pool);
+  }
+}
+
+
+//forward and backward pass of a batch, gradients are accumulated in the layers
+template<typename Inputs>
+void omnilearn::Network::backpropagate(std::vector<Layer>& layers, Inputs const& input, Matrix const& output, std::mt19937& generator, std::bernoulli_distribution& dropoutDist, std::bernoulli_distribution& dropconnectDist, ThreadPool& t)
+{
+  //sparse inputs stop at the first layer
+  Matrix result = layers[0].processToLearn(input, _param.dropout, _param.dropconnect, dropoutDist, dropconnectDist, generator, t);
+  for(size_t i = 1; i < layers.size(); i++)
+  {
+    result = layers[i].processToLearn(result, _param.dropout, _param.dropconnect, dropoutDist, dropconnectDist, generator, t);
+  }
+
+  Matrix gradients(computeGradMatrix(output, result, t));
+  for(size_t i = 0; i < layers.size(); i++)
+  {
+    layers[layers.size() - i - 1].computeGradients(gradients, t);
+    //the first layer doesn't need to backpropagate
+    if(i < layers.size() - 1)
+      gradients = layers[layers.size() - i - 1].getBatchGradients(t);
+  }
+}
+
+
+//process taking already processed inputs and giving processed outputs, starting at layer firstLayer
+omnilearn::Matrix omnilearn::Network::processForLoss(Matrix inputs, size_t firstLayer) const
+{
+  for(size_t i = firstLayer; i < _layers.size(); i++)
   {
     inputs = _layers[i].process(inputs, _pool);
   }
@@ -1020,6 +2104,35 @@ omnilearn::Matrix omnilearn::Network::processForLoss(Matrix inputs) const
 }
 
 
+omnilearn::Matrix omnilearn::Network::processForLoss(SparseMatrix const& inputs) const
+{
+  return processForLoss(_layers[0].process(inputs, _pool), 1);
+}
+
+
+//outputs of the raw test features
+omnilearn::Matrix omnilearn::Network::processTestData() const
+{
+  if(sparseInputs())
+    return process(_testRawSparseInputs);
+  return process(_testRawInputs);
+}
+
+
+bool omnilearn::Network::sparseInputs() const
+{
+  return _sparseInputs.cols() != 0;
+}
+
+
+double omnilearn::Network::optimizerWindow() const
+{
+  if(_param.optimizer == Optimizer::Adam || _param.optimizer == Optimizer::Adamax || _param.optimizer == Optimizer::Nadam || _param.optimizer == Optimizer::AmsGrad)
+    return _param.adamWindow;
+  return _param.window;
+}
+
+
 omnilearn::Matrix omnilearn::Network::computeLossMatrix(Matrix const& realResult, Matrix const& predicted)
 {
   if(_param.loss == Loss::L1)
@@ -1046,56 +2159,64 @@ omnilearn::Vector omnilearn::Network::computeGradVector(Vector const& realResult
 }
 
 
+omnilearn::Matrix omnilearn::Network::computeGradMatrix(Matrix const& realResult, Matrix const& predicted, ThreadPool& t)
+{
+  if(_param.loss == Loss::L1)
+    return L1Grad(realResult, predicted, t);
+  else if(_param.loss == Loss::L2)
+    return L2Grad(realResult, predicted, t);
+  else if(_param.loss == Loss::BinaryCrossEntropy)
+    return binaryCrossEntropyGrad(realResult, predicted, t);
+  else //if loss == crossEntropy
+    return crossEntropyGrad(realResult, predicted, t);
+}
+
+
 //return validation loss
 double omnilearn::Network::computeLoss()
 {
-  //for each layer, for each neuron, first are weights, second are bias
-  std::vector<std::vector<std::pair<Matrix, Vector>>> weights(_layers.size());
-  for(size_t i = 0; i < _layers.size(); i++)
-  {
-    weights[i] = _layers[i].getWeights(_pool);
-  }
-
   //L1 and L2 regularization loss
   double L1 = 0;
   double L2 = 0;
 
-  for(size_t i = 0; i < weights.size(); i++)
-  //for each layer
+  for(size_t i = 0; i < _layers.size(); i++)
   {
-    for(size_t j = 0; j < weights[i].size(); j++)
-    //for each neuron
-    {
-      for(eigen_size_t k = 0; k < weights[i][j].first.rows(); k++)
-      //for each weight set
-      {
-        for(eigen_size_t l = 0; l < weights[i][j].first.cols(); l++)
-        //for each weight
-        {
-          L1 += std::abs(weights[i][j].first(k, l));
-          L2 += std::pow(weights[i][j].first(k, l), 2);
-        }
-      }
-    }
+    L1 += _layers[i].getWeights().cwiseAbs().sum();
+    L2 += _layers[i].getWeights().squaredNorm();
   }
 
   L1 *= _param.L1;
   L2 *= (_param.L2 * 0.5);
 
   //training loss
-  Matrix input = _trainInputs;
-  Matrix output = _trainOutputs;
-  double trainLoss = averageLoss(computeLossMatrix(output, processForLoss(input))) + L1 + L2;
+  double trainLoss = 0;
+  if(_source)
+  {
+    //windows are weighted by their number of features
+    streamTrainData(streamBlocks(), _param.preprocessInputs.size(), _param.preprocessOutputs.size(), [this, &trainLoss](Matrix& inputs, Matrix& outputs)->void
+    {
+      trainLoss += averageLoss(computeLossMatrix(outputs, processForLoss(inputs))) * static_cast<double>(inputs.rows());
+    });
+    trainLoss = trainLoss / static_cast<double>(_trainSize) + L1 + L2;
+  }
+  else
+  {
+    eigen_size_t nbTrain = static_cast<eigen_size_t>(_trainSize);
+    Matrix predicted = (sparseInputs() ? processForLoss(SparseMatrix(_sparseInputs.topRows(nbTrain))) : processForLoss(_inputs.topRows(nbTrain)));
+    trainLoss = averageLoss(computeLossMatrix(_outputs.topRows(nbTrain), predicted)) + L1 + L2;
+  }
 
   //validation loss
-  double validationLoss = averageLoss(computeLossMatrix(_validationOutputs, processForLoss(_validationInputs))) + L1 + L2;
+  eigen_size_t nbValidation = static_cast<eigen_size_t>(_validationSize);
+  Matrix predicted = (sparseInputs() ? processForLoss(SparseMatrix(_sparseInputs.bottomRows(nbValidation))) : processForLoss(_inputs.bottomRows(nbValidation)));
+  double validationLoss = averageLoss(computeLossMatrix(_outputs.bottomRows(nbValidation), predicted)) + L1 + L2;
 
   //test metric
   std::pair<double, double> testMetric;
   if(_param.loss == Loss::L1 || _param.loss == Loss::L2)
-    testMetric = regressionMetrics(_testNormalizedOutputsForMetric, process(_testRawInputs), _metricNormalization);
+    testMetric = regressionMetrics(_testNormalizedOutputsForMetric, processTestData(), _metricNormalization);
   else
-    testMetric = classificationMetrics(_testRawOutputs, process(_testRawInputs), _param.classValidity);
+    testMetric = classificationMetrics(_testRawOutputs, processTestData(), _param.classValidity);
 
   std::cout << "   Valid_Loss: " << validationLoss << "   Train_Loss: " << trainLoss << "   First metric: " << (testMetric.first) << "   Second metric: " << (testMetric.second);
   _trainLosses.conservativeResize(_trainLosses.size() + 1);
@@ -1110,12 +2231,31 @@ double omnilearn::Network::computeLoss()
 }
 
 
+//the parameters are copied in the Saved tensors of the layers by another thread, which then writes the
+//best model file from them. Training goes on meanwhile: forward and backward passes only read the parameters,
+//the first update waits for the end of the copy (waitSnapshot). The file is written during the next epoch
 void omnilearn::Network::save()
 {
+  waitSnapshot(true);
+  std::promise<void> copied;
+  _snapshotCopy = copied.get_future();
+  _snapshot = std::async(std::launch::async, [this](std::promise<void> copyDone)->void
+  {
     for(size_t i = 0; i < _layers.size(); i++)
-    {
-        _layers[i].save();
-    }
+      _layers[i].save();
+    copyDone.set_value();
+    writeModelFile(_param.name + ".omnimodel", true);
+  }, std::move(copied));
+}
+
+
+//rethrows the exception of the snapshot, if any
+void omnilearn::Network::waitSnapshot(bool written)
+{
+  if(_snapshotCopy.valid())
+    _snapshotCopy.get();
+  if(written && _snapshot.valid())
+    _snapshot.get();
 }
 
 
@@ -0,0 +1,108 @@
+// Prefetcher.cpp
+
+#include "omnilearn/Prefetcher.hh"
+
+
+
+omnilearn::Prefetcher::Prefetcher(size_t depth, std::function<bool(Batch&)> producer):
+_producer(producer),
+_batches(depth + 1),
+_free(),
+_ready(),
+_current(depth + 1),
+_done(false),
+_stop(false),
+_error(),
+_mutex(),
+_condition(),
+_thread()
+{
+    if(depth > 0)
+    {
+        for(size_t i = 0; i < _batches.size(); i++)
+            _free.push_back(i);
+        _thread = std::thread(&Prefetcher::run, this);
+    }
+}
+
+
+omnilearn::Prefetcher::~Prefetcher()
+{
+    if(_thread.joinable())
+    {
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _stop = true;
+        }
+        _condition.notify_all();
+        _thread.join();
+    }
+}
+
+
+omnilearn::Prefetcher::Batch* omnilearn::Prefetcher::next()
+{
+    //without background thread, the last batch is filled here
+    if(!_thread.joinable())
+    {
+        if(_done || !_producer(_batches.back()))
+        {
+            _done = true;
+            return nullptr;
+        }
+        return &_batches.back();
+    }
+
+    std::unique_lock<std::mutex> lock(_mutex);
+    //the batch being used so far can be refilled
+    if(_current < _batches.size())
+    {
+        _free.push_back(_current);
+        _current = _batches.size();
+        _condition.notify_all();
+    }
+    _condition.wait(lock, [this]{ return !_ready.empty() || _done; });
+    if(_ready.empty())
+    {
+        if(_error)
+            std::rethrow_exception(_error);
+        return nullptr;
+    }
+    _current = _ready.front();
+    _ready.pop_front();
+    _condition.notify_all();
+    return &_batches[_current];
+}
+
+
+void omnilearn::Prefetcher::run()
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    while(true)
+    {
+        _condition.wait(lock, [this]{ return !_free.empty() || _stop; });
+        if(_stop)
+            break;
+        size_t batch = _free.front();
+        _free.pop_front();
+        lock.unlock();
+        bool filled = false;
+        try
+        {
+            filled = _producer(_batches[batch]);
+        }
+        catch(...)
+        {
+            lock.lock();
+            _error = std::current_exception();
+            break;
+        }
+        lock.lock();
+        if(!filled)
+            break;
+        _ready.push_back(batch);
+        _condition.notify_all();
+    }
+    _done = true;
+    _condition.notify_all();
+}
@@ -7,19 +7,16 @@
 omnilearn::Matrix omnilearn::L1Loss(Matrix const& real, Matrix const& predicted, ThreadPool& t)
 {
     Matrix loss(real.rows(), real.cols());
-    std::vector<std::future<void>> tasks(loss.rows());
-    for(eigen_size_t i = 0; i < loss.rows(); i++)
+    t.parallel_for(0, static_cast<size_t>(loss.rows()), ThreadPool::grain(static_cast<size_t>(loss.cols())), [&real, &predicted, &loss](size_t begin, size_t end)->void
     {
-        tasks[i] = t.enqueue([&real, &predicted, &loss, i]()->void
+        for(eigen_size_t i = static_cast<eigen_size_t>(begin); i < static_cast<eigen_size_t>(end); i++)
         {
             for(eigen_size_t j = 0; j < loss.cols(); j++)
             {
                 loss(i, j) = std::abs(real(i, j) - predicted(i, j));
             }
-        });
-    }
-    for(size_t i = 0; i < tasks.size(); i++)
-        tasks[i].get();
+        }
+    });
     return loss;
 }
 
@@ -27,10 +24,9 @@ omnilearn::Matrix omnilearn::L1Loss(Matrix const& real, Matrix const& predicted,
 omnilearn::Vector omnilearn::L1Grad(Vector const& real, Vector const& predicted, ThreadPool& t)
 {
     Vector gradients(real.size());
-    std::vector<std::future<void>> tasks(real.size());
-    for(eigen_size_t i = 0; i < real.size(); i++)
+    t.parallel_for(0, static_cast<size_t>(real.size()), ThreadPool::grain(1), [&real, &predicted, &gradients](size_t begin, size_t end)->void
     {
-        tasks[i] = t.enqueue([&real, &predicted, &gradients, i]()->void
+        for(eigen_size_t i = static_cast<eigen_size_t>(begin); i < static_cast<eigen_size_t>(end); i++)
         {
             if (real(i) < predicted(i))
                 gradients(i) = -1;
@@ -38,10 +34,30 @@ omnilearn::Vector omnilearn::L1Grad(Vector const& real, Vector const& predicted,
                 gradients(i) = 1;
             else
                 gradients(i) = 0;
-        });
-    }
-    for(size_t i = 0; i < tasks.size(); i++)
-        tasks[i].get();
+        }
+    });
+    return gradients;
+}
+
+
+omnilearn::Matrix omnilearn::L1Grad(Matrix const& real, Matrix const& predicted, ThreadPool& t)
+{
+    Matrix gradients(real.rows(), real.cols());
+    t.parallel_for(0, static_cast<size_t>(gradients.rows()), ThreadPool::grain(static_cast<size_t>(gradients.cols())), [&real, &predicted, &gradients](size_t begin, size_t end)->void
+    {
+        for(eigen_size_t i = static_cast<eigen_size_t>(begin); i < static_cast<eigen_size_t>(end); i++)
+        {
+            for(eigen_size_t j = 0; j < gradients.cols(); j++)
+            {
+                if (real(i, j) < predicted(i, j))
+                    gradients(i, j) = -1;
+                else if (real(i, j) > predicted(i, j))
+                    gradients(i, j) = 1;
+                else
+                    gradients(i, j) = 0;
+            }
+        }
+    });
     return gradients;
 }
 
@@ -49,19 +65,16 @@ omnilearn::Vector omnilearn::L1Grad(Vector const& real, Vector const& predicted,
 omnilearn::Matrix omnilearn::L2Loss(Matrix const& real, Matrix const& predicted, ThreadPool& t)
 {
     Matrix loss(real.rows(), real.cols());
-    std::vector<std::future<void>> tasks(loss.rows());
-    for(eigen_size_t i = 0; i < loss.rows(); i++)
+    t.parallel_for(0, static_cast<size_t>(loss.rows()), ThreadPool::grain(static_cast<size_t>(loss.cols())), [&real, &predicted, &loss](size_t begin, size_t end)->void
     {
-        tasks[i] = t.enqueue([&real, &predicted, &loss, i]()->void
+        for(eigen_size_t i = static_cast<eigen_size_t>(begin); i < static_cast<eigen_size_t>(end); i++)
         {
             for(eigen_size_t j = 0; j < loss.cols(); j++)
             {
                 loss(i, j) = 0.5 * std::pow(real(i, j) - predicted(i, j), 2);
             }
-        });
-    }
-    for(size_t i = 0; i < tasks.size(); i++)
-        tasks[i].get();
+        }
+    });
     return loss;
 }
 
@@ -69,16 +82,30 @@ omnilearn::Matrix omnilearn::L2Loss(Matrix const& real, Matrix const& predicted,
 omnilearn::Vector omnilearn::L2Grad(Vector const& real, Vector const& predicted, ThreadPool& t)
 {
     Vector gradients(real.size());
-    std::vector<std::future<void>> tasks(real.size());
-    for(eigen_size_t i = 0; i < real.size(); i++)
+    t.parallel_for(0, static_cast<size_t>(real.size()), ThreadPool::grain(1), [&real, &predicted, &gradients](size_t begin, size_t end)->void
     {
-        tasks[i] = t.enqueue([&real, &predicted, &gradients, i]()->void
+        for(eigen_size_t i = static_cast<eigen_size_t>(begin); i < static_cast<eigen_size_t>(end); i++)
         {
             gradients(i) = (real(i) - predicted(i));
-        });
-    }
-    for(size_t i = 0; i < tasks.size(); i++)
-        tasks[i].get();
+        }
+    });
+    return gradients;
+}
+
+
+omnilearn::Matrix omnilearn::L2Grad(Matrix const& real, Matrix const& predicted, ThreadPool& t)
+{
+    Matrix gradients(real.rows(), real.cols());
+    t.parallel_for(0, static_cast<size_t>(gradients.rows()), ThreadPool::grain(static_cast<size_t>(gradients.cols())), [&real, &predicted, &gradients](size_t begin, size_t end)->void
+    {
+        for(eigen_size_t i = static_cast<eigen_size_t>(begin); i < static_cast<eigen_size_t>(end); i++)
+        {
+            for(eigen_size_t j = 0; j < gradients.cols(); j++)
+            {
+                gradients(i, j) = (real(i, j) - predicted(i, j));
+            }
+        }
+    });
     return gradients;
 }
 
@@ -87,19 +114,16 @@ omnilearn::Matrix omnilearn::crossEntropyLoss(Matrix const& real, Matrix const&
 {
     Matrix softMax = softmax(predicted);
     Matrix loss(real.rows(), real.cols());
-    std::vector<std::future<void>> tasks(loss.rows());
-    for(eigen_size_t i = 0; i < loss.rows(); i++)
+    t.parallel_for(0, static_cast<size_t>(loss.rows()), ThreadPool::grain(static_cast<size_t>(loss.cols())), [&real, &predicted, &softMax, &loss](size_t begin, size_t end)->void
     {
-        tasks[i] = t.enqueue([&real, &predicted, &softMax, &loss, i]()->void
+        for(eigen_size_t i = static_cast<eigen_size_t>(begin); i < static_cast<eigen_size_t>(end); i++)
         {
             for(eigen_size_t j = 0; j < loss.cols(); j++)
             {
                 loss(i, j) = real(i, j) * -std::log(softMax(i, j));
             }
-        });
-    }
-    for(size_t i = 0; i < tasks.size(); i++)
-        tasks[i].get();
+        }
+    });
     return loss;
 }
 
@@ -108,16 +132,31 @@ omnilearn::Vector omnilearn::crossEntropyGrad(Vector const& real, Vector const&
 {
     Vector softMax = singleSoftmax(predicted);
     Vector gradients(real.size());
-    std::vector<std::future<void>> tasks(real.size());
-    for(eigen_size_t i = 0; i < real.size(); i++)
+    t.parallel_for(0, static_cast<size_t>(real.size()), ThreadPool::grain(1), [&real, &predicted, &softMax, &gradients](size_t begin, size_t end)->void
     {
-        tasks[i] = t.enqueue([&real, &predicted, &softMax, &gradients, i]()->void
+        for(eigen_size_t i = static_cast<eigen_size_t>(begin); i < static_cast<eigen_size_t>(end); i++)
         {
             gradients(i) = real(i) - softMax(i);
-        });
-    }
-    for(size_t i = 0; i < tasks.size(); i++)
-        tasks[i].get();
+        }
+    });
+    return gradients;
+}
+
+
+omnilearn::Matrix omnilearn::crossEntropyGrad(Matrix const& real, Matrix const& predicted, ThreadPool& t)
+{
+    Matrix softMax = softmax(predicted);
+    Matrix gradients(real.rows(), real.cols());
+    t.parallel_for(0, static_cast<size_t>(gradients.rows()), ThreadPool::grain(static_cast<size_t>(gradients.cols())), [&real, &softMax, &gradients](size_t begin, size_t end)->void
+    {
+        for(eigen_size_t i = static_cast<eigen_size_t>(begin); i < static_cast<eigen_size_t>(end); i++)
+        {
+            for(eigen_size_t j = 0; j < gradients.cols(); j++)
+            {
+                gradients(i, j) = real(i, j) - softMax(i, j);
+            }
+        }
+    });
     return gradients;
 }
 
@@ -125,19 +164,16 @@ omnilearn::Vector omnilearn::crossEntropyGrad(Vector const& real, Vector const&
 omnilearn::Matrix omnilearn::binaryCrossEntropyLoss(Matrix const& real, Matrix const& predicted, ThreadPool& t)
 {
     Matrix loss(real.rows(), real.cols());
-    std::vector<std::future<void>> tasks(loss.rows());
-    for(eigen_size_t i = 0; i < loss.rows(); i++)
+    t.parallel_for(0, static_cast<size_t>(loss.rows()), ThreadPool::grain(static_cast<size_t>(loss.cols())), [&real, &predicted, &loss](size_t begin, size_t end)->void
     {
-        tasks[i] = t.enqueue([&real, &predicted, &loss, i]()->void
+        for(eigen_size_t i = static_cast<eigen_size_t>(begin); i < static_cast<eigen_size_t>(end); i++)
         {
             for(eigen_size_t j = 0; j < loss.cols(); j++)
             {
                 loss(i, j) = -(real(i, j) * std::log(predicted(i, j)) + (1 - real(i, j)) * std::log(1 - predicted(i, j)));
             }
-        });
-    }
-    for(size_t i = 0; i < tasks.size(); i++)
-        tasks[i].get();
+        }
+    });
     return loss;
 }
 
@@ -145,15 +181,29 @@ omnilearn::Matrix omnilearn::binaryCrossEntropyLoss(Matrix const& real, Matrix c
 omnilearn::Vector omnilearn::binaryCrossEntropyGrad(Vector const& real, Vector const& predicted, ThreadPool& t)
 {
     Vector gradients(real.size());
-    std::vector<std::future<void>> tasks(real.size());
-    for(eigen_size_t i = 0; i < real.size(); i++)
+    t.parallel_for(0, static_cast<size_t>(real.size()), ThreadPool::grain(1), [&real, &predicted, &gradients](size_t begin, size_t end)->void
     {
-        tasks[i] = t.enqueue([&real, &predicted, &gradients, i]()->void
+        for(eigen_size_t i = static_cast<eigen_size_t>(begin); i < static_cast<eigen_size_t>(end); i++)
         {
             gradients(i) = (real(i) - predicted(i)) / ( predicted(i) * (1 -  predicted(i)));
-        });
-    }
-    for(size_t i = 0; i < tasks.size(); i++)
-        tasks[i].get();
+        }
+    });
+    return gradients;
+}
+
+
+omnilearn::Matrix omnilearn::binaryCrossEntropyGrad(Matrix const& real, Matrix const& predicted, ThreadPool& t)
+{
+    Matrix gradients(real.rows(), real.cols());
+    t.parallel_for(0, static_cast<size_t>(gradients.rows()), ThreadPool::grain(static_cast<size_t>(gradients.cols())), [&real, &predicted, &gradients](size_t begin, size_t end)->void
+    {
+        for(eigen_size_t i = static_cast<eigen_size_t>(begin); i < static_cast<eigen_size_t>(end); i++)
+        {
+            for(eigen_size_t j = 0; j < gradients.cols(); j++)
+            {
+                gradients(i, j) = (real(i, j) - predicted(i, j)) / ( predicted(i, j) * (1 -  predicted(i, j)));
+            }
+        }
+    });
     return gradients;
 }
\ No newline at end of file
@@ -1,74 +1,453 @@
 // csv.cpp
 
 #include "omnilearn/csv.hh"
+#include "omnilearn/MappedFile.hh"
 
+#include <algorithm>
+#include <charconv>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
 
 
-omnilearn::Data omnilearn::loadData(std::string const& path, char separator, size_t threads)
+
+//end of the line starting at pos (position of '\n' or end)
+static char const* lineEnd(char const* pos, char const* end)
 {
-  std::fstream dataFile(path);
-  std::vector<std::string> content;
-  Data data;
+  char const* found = static_cast<char const*>(std::memchr(pos, '\n', static_cast<size_t>(end - pos)));
+  return (found == nullptr ? end : found);
+}
+
+
+//a line only made of '\r' is empty (windows line ending)
+static bool isEmptyLine(char const* begin, char const* end)
+{
+  return begin == end || (end - begin == 1 && *begin == '\r');
+}
 
-  //load data
-  while(dataFile.good())
-  {
-    content.push_back("");
-    std::getline(dataFile, content[content.size()-1]);
-  }
 
-  size_t elements = static_cast<size_t>(std::count(content[0].begin(), content[0].end(), separator));
+//parses the value starting at pos, then moves pos after the next separator
+static double readValue(char const*& pos, char const* end, char separator, size_t feature)
+{
+  while(pos < end && (*pos == ' ' || *pos == '\t'))
+    pos++;
+  if(pos < end && *pos == '+')
+    pos++;
+  double value = 0;
+  std::from_chars_result result = std::from_chars(pos, end, value);
+  if(result.ec != std::errc())
+    throw omnilearn::Exception("Invalid value in feature " + std::to_string(feature) + " of the csv.");
+  pos = static_cast<char const*>(std::memchr(result.ptr, separator, static_cast<size_t>(end - result.ptr)));
+  pos = (pos == nullptr ? end : pos + 1);
+  return value;
+}
+
+
+//reads the labels of the header line, returns the end of this line
+static char const* parseLabels(char const* begin, char const* end, char separator, std::vector<std::string>& inputLabels, std::vector<std::string>& outputLabels)
+{
+  char const* headerEnd = lineEnd(begin, end);
+  std::string header(begin, headerEnd);
+  if(!header.empty() && header.back() == '\r')
+    header.pop_back();
+
+  size_t elements = static_cast<size_t>(std::count(header.begin(), header.end(), separator));
   size_t i = 0;
 
   //extract inputs labels
   std::string val;
-  if (content[0].find(separator) == std::string::npos)
-    throw Exception("Wrong separator used to read csv.");
+  if (header.find(separator) == std::string::npos)
+    throw omnilearn::Exception("Wrong separator used to read csv.");
 
   for(i = 0; i < elements; i++)
   {
-    val = content[0].substr(0, content[0].find(separator));
+    val = header.substr(0, header.find(separator));
     if(val == "")
       break;
-    data.inputLabels.push_back(val);
-    content[0].erase(0, content[0].find(separator) + 1);
+    inputLabels.push_back(val);
+    header.erase(0, header.find(separator) + 1);
   }
-  content[0].erase(0, content[0].find(separator) + 1);
+  header.erase(0, header.find(separator) + 1);
 
   //extract output labels
   for(; i < elements; i++)
   {
-    val = content[0].substr(0, content[0].find(separator));
-    data.outputLabels.push_back(val);
-    content[0].erase(0, content[0].find(separator) + 1);
+    val = header.substr(0, header.find(separator));
+    outputLabels.push_back(val);
+    header.erase(0, header.find(separator) + 1);
   }
+  return headerEnd;
+}
+
+
+//parses the non-empty line [pos, end) of the given feature
+static void parseLine(char const* pos, char const* end, char separator, size_t feature, double* inputs, eigen_size_t nbInputs, double* outputs, eigen_size_t nbOutputs)
+{
+  for(eigen_size_t col = 0; col < nbInputs; col++)
+    inputs[col] = readValue(pos, end, separator, feature);
+  //skip the empty column between inputs and outputs
+  pos = static_cast<char const*>(std::memchr(pos, separator, static_cast<size_t>(end - pos)));
+  pos = (pos == nullptr ? end : pos + 1);
+  for(eigen_size_t col = 0; col < nbOutputs; col++)
+    outputs[col] = readValue(pos, end, separator, feature);
+}
+
+
+//binary format: header, labels (length + characters), then the inputs and the outputs,
+//row-major, each block starting on a 64 bytes boundary. Numbers are in the machine byte order
+static char const omnidataMagic[8] = {'O', 'M', 'N', 'I', 'D', 'A', 'T', 'A'};
+static uint32_t const omnidataVersion = 1;
+
+
+struct OmnidataHeader
+{
+  char magic[8];
+  uint32_t version;
+  uint32_t scalarSize; //size of each value, in bytes
+  uint64_t rows;
+  uint64_t inputCols;
+  uint64_t outputCols;
+  uint64_t sourceHash;
+  uint64_t labelsSize; //size of the labels block, in bytes
+};
+
 
-  data.inputs  = Matrix(content.size()-1, data.inputLabels.size());
-  data.outputs = Matrix(content.size()-1, data.outputLabels.size());
+//identifies the content of a csv by its size, modification time and separator (FNV-1a)
+static size_t csvHash(std::string const& path, char separator)
+{
+  uint64_t values[3] = {static_cast<uint64_t>(std::filesystem::file_size(path)),
+                        static_cast<uint64_t>(std::filesystem::last_write_time(path).time_since_epoch().count()),
+                        static_cast<uint64_t>(separator)};
+  uint64_t hash = 14695981039346656037ULL;
+  for(uint64_t value : values)
+    for(size_t i = 0; i < 8; i++)
+    {
+      hash ^= (value >> (8 * i)) & 0xff;
+      hash *= 1099511628211ULL;
+    }
+  //0 means that no csv is associated with the data
+  return static_cast<size_t>(hash == 0 ? 1 : hash);
+}
+
+
+static omnilearn::Data parseCsv(std::string const& path, char separator, size_t threads)
+{
+  using namespace omnilearn;
+
+  MappedFile file(path);
+  char const* fileEnd = file.data() + file.size();
+  Data data;
 
+  if(file.size() == 0)
+    throw Exception("The csv " + path + " is empty.");
+
+  char const* headerEnd = parseLabels(file.data(), fileEnd, separator, data.inputLabels, data.outputLabels);
+
+  //split the body into byte ranges starting at the beginning of a line
+  char const* body = (headerEnd == fileEnd ? fileEnd : headerEnd + 1);
+  size_t bodySize = static_cast<size_t>(fileEnd - body);
   ThreadPool t(threads);
-  std::vector<std::future<void>> tasks(content.size()-1);
+  size_t nbRanges = std::max(static_cast<size_t>(1), std::min(4 * threads, bodySize / 65536));
+  std::vector<char const*> bounds(nbRanges + 1, fileEnd);
+  bounds[0] = body;
+  for(size_t r = 1; r < nbRanges; r++)
+  {
+    char const* bound = std::max(bounds[r-1], body + r * (bodySize / nbRanges));
+    //move the bound at the beginning of the next line
+    if(bound != body && bound < fileEnd && *(bound - 1) != '\n')
+      bound = lineEnd(bound, fileEnd);
+    bounds[r] = (bound < fileEnd && *bound == '\n' ? bound + 1 : bound);
+  }
 
-  for(size_t j = 0; j < content.size()-1; j++)
+  //count the lines of each range to know where its features go
+  std::vector<size_t> firstRow(nbRanges + 1, 0);
+  t.parallel_for(0, nbRanges, 1, [&bounds, &firstRow](size_t begin, size_t end)->void
   {
-    tasks[j] = t.enqueue([j, &content, &data, separator]()->void
-    {
-      std::string line = content[j+1]; // do not read the label line
-      for(size_t col = 0; col < data.inputLabels.size(); col++)
+    for(size_t r = begin; r < end; r++)
+      for(char const* pos = bounds[r]; pos < bounds[r+1];)
       {
-        data.inputs(j,col) = (std::stod(line.substr(0, line.find(separator))));
-        line.erase(0, line.find(separator) + 1);
+        char const* next = lineEnd(pos, bounds[r+1]);
+        if(!isEmptyLine(pos, next))
+          firstRow[r+1]++;
+        pos = next + 1;
       }
-      line.erase(0, line.find(separator) + 1);
-      for(size_t col = 0; col < data.outputLabels.size(); col++)
+  });
+  for(size_t r = 0; r < nbRanges; r++)
+    firstRow[r+1] += firstRow[r];
+
+  data.inputs  = Matrix(firstRow[nbRanges], data.inputLabels.size());
+  data.outputs = Matrix(firstRow[nbRanges], data.outputLabels.size());
+
+  //parse each range directly into the matrices
+  t.parallel_for(0, nbRanges, 1, [&bounds, &firstRow, &data, separator](size_t begin, size_t end)->void
+  {
+    eigen_size_t nbInputs = static_cast<eigen_size_t>(data.inputLabels.size());
+    eigen_size_t nbOutputs = static_cast<eigen_size_t>(data.outputLabels.size());
+    for(size_t r = begin; r < end; r++)
+    {
+      size_t row = firstRow[r];
+      for(char const* pos = bounds[r]; pos < bounds[r+1];)
       {
-        data.outputs(j,col) = (std::stod(line.substr(0, line.find(separator))));
-        line.erase(0, line.find(separator) + 1);
+        char const* next = lineEnd(pos, bounds[r+1]);
+        if(!isEmptyLine(pos, next))
+        {
+          parseLine(pos, next, separator, row + 1, data.inputs.row(static_cast<eigen_size_t>(row)).data(), nbInputs, data.outputs.row(static_cast<eigen_size_t>(row)).data(), nbOutputs);
+          row++;
+        }
+        pos = next + 1;
       }
-    });
+    }
+  });
+
+  return data;
+}
+
+
+omnilearn::Data omnilearn::loadData(std::string const& path, char separator, size_t threads, bool cache)
+{
+  if(!cache)
+    return parseCsv(path, separator, threads);
+
+  std::string cachePath = path + ".omnidata";
+  size_t hash = csvHash(path, separator);
+  if(std::filesystem::exists(cachePath))
+  {
+    try
+    {
+      MappedData mapped(cachePath);
+      if(mapped.sourceHash == hash)
+        return mapped.toData();
+    }
+    catch(Exception const&)
+    {
+      //unreadable cache, it is rebuilt
+    }
   }
-  for(i = 0; i < tasks.size(); i++)
-    tasks[i].get();
+  Data data = parseCsv(path, separator, threads);
+  saveData(data, cachePath, hash);
+  return data;
+}
+
 
+void omnilearn::saveData(Data const& data, std::string const& path, size_t sourceHash)
+{
+  std::string labels;
+  for(std::vector<std::string> const* vec : {&data.inputLabels, &data.outputLabels})
+    for(std::string const& label : *vec)
+    {
+      uint32_t length = static_cast<uint32_t>(label.size());
+      labels.append(reinterpret_cast<char const*>(&length), sizeof(length));
+      labels.append(label);
+    }
+
+  OmnidataHeader header;
+  std::memcpy(header.magic, omnidataMagic, sizeof(header.magic));
+  header.version = omnidataVersion;
+  header.scalarSize = sizeof(double);
+  header.rows = static_cast<uint64_t>(data.inputs.rows());
+  header.inputCols = static_cast<uint64_t>(data.inputs.cols());
+  header.outputCols = static_cast<uint64_t>(data.outputs.cols());
+  header.sourceHash = sourceHash;
+  header.labelsSize = labels.size();
+
+  if(data.sparseInputs.cols() != 0)
+    throw Exception("Sparse inputs cannot be saved in the binary format.");
+  if(data.outputs.rows() != data.inputs.rows())
+    throw Exception("Inputs and outputs must have the same number of features to be saved.");
+  if(data.inputLabels.size() != header.inputCols || data.outputLabels.size() != header.outputCols)
+    throw Exception("There must be one label per column to save the data.");
+
+  std::ofstream file(path, std::ios::binary | std::ios::trunc);
+  if(!file)
+    throw Exception("Cannot open " + path + ".");
+  std::string const padding(64, '\0');
+  size_t offset = sizeof(header) + labels.size();
+  file.write(reinterpret_cast<char const*>(&header), sizeof(header));
+  file.write(labels.data(), static_cast<std::streamsize>(labels.size()));
+  for(Matrix const* matrix : {&data.inputs, &data.outputs})
+  {
+    file.write(padding.data(), static_cast<std::streamsize>(align64(offset) - offset));
+    offset = align64(offset);
+    size_t size = static_cast<size_t>(matrix->size()) * sizeof(double);
+    file.write(reinterpret_cast<char const*>(matrix->data()), static_cast<std::streamsize>(size));
+    offset += size;
+  }
+  if(!file)
+    throw Exception("Cannot write " + path + ".");
+}
+
+
+omnilearn::MappedData omnilearn::loadDataBinary(std::string const& path)
+{
+  return MappedData(path);
+}
+
+
+omnilearn::MappedData::MappedData(std::string const& path):
+file(std::make_shared<MappedFile const>(path)),
+sourceHash(0),
+inputs(nullptr, 0, 0),
+outputs(nullptr, 0, 0),
+inputLabels(),
+outputLabels()
+{
+  OmnidataHeader header;
+  if(file->size() < sizeof(header))
+    throw Exception(path + " is not an omnidata file.");
+  std::memcpy(&header, file->data(), sizeof(header));
+  if(std::memcmp(header.magic, omnidataMagic, sizeof(header.magic)) != 0)
+    throw Exception(path + " is not an omnidata file.");
+  if(header.version != omnidataVersion || header.scalarSize != sizeof(double))
+    throw Exception(path + " has an unsupported omnidata version.");
+
+  //read labels
+  size_t offset = sizeof(header);
+  if(header.labelsSize > file->size() - offset)
+    throw Exception(path + " is truncated.");
+  size_t labelsEnd = offset + header.labelsSize;
+  for(uint64_t i = 0; i < header.inputCols + header.outputCols; i++)
+  {
+    uint32_t length = 0;
+    if(offset + sizeof(length) > labelsEnd)
+      throw Exception(path + " is truncated.");
+    std::memcpy(&length, file->data() + offset, sizeof(length));
+    offset += sizeof(length);
+    if(offset + length > labelsEnd)
+      throw Exception(path + " is truncated.");
+    (i < header.inputCols ? inputLabels : outputLabels).emplace_back(file->data() + offset, length);
+    offset += length;
+  }
+
+  //map the matrices on the file
+  size_t inputsOffset = align64(labelsEnd);
+  if(!blockFits(inputsOffset, header.rows, header.inputCols, file->size()))
+    throw Exception(path + " is truncated.");
+  size_t outputsOffset = align64(inputsOffset + header.rows * header.inputCols * sizeof(double));
+  if(!blockFits(outputsOffset, header.rows, header.outputCols, file->size()))
+    throw Exception(path + " is truncated.");
+  double const* base = reinterpret_cast<double const*>(file->data());
+  new (&inputs) Eigen::Map<Matrix const>(base + inputsOffset / sizeof(double), static_cast<eigen_size_t>(header.rows), static_cast<eigen_size_t>(header.inputCols));
+  new (&outputs) Eigen::Map<Matrix const>(base + outputsOffset / sizeof(double), static_cast<eigen_size_t>(header.rows), static_cast<eigen_size_t>(header.outputCols));
+  sourceHash = header.sourceHash;
+}
+
+
+omnilearn::Data omnilearn::MappedData::toData() const
+{
+  Data data;
+  data.inputs = inputs;
+  data.outputs = outputs;
+  data.inputLabels = inputLabels;
+  data.outputLabels = outputLabels;
   return data;
-}
\ No newline at end of file
+}
+
+
+omnilearn::BinaryDataSource::BinaryDataSource(std::string const& path):
+_data(path)
+{
+}
+
+
+size_t omnilearn::BinaryDataSource::size() const
+{
+  return static_cast<size_t>(_data.inputs.rows());
+}
+
+
+std::vector<std::string> const& omnilearn::BinaryDataSource::inputLabels() const
+{
+  return _data.inputLabels;
+}
+
+
+std::vector<std::string> const& omnilearn::BinaryDataSource::outputLabels() const
+{
+  return _data.outputLabels;
+}
+
+
+void omnilearn::BinaryDataSource::read(size_t first, size_t count, Matrix& inputs, Matrix& outputs) const
+{
+  if(first + count > size())
+    throw Exception("Features " + std::to_string(first) + " to " + std::to_string(first + count) + " are out of the dataset.");
+  inputs = _data.inputs.middleRows(static_cast<eigen_size_t>(first), static_cast<eigen_size_t>(count));
+  outputs = _data.outputs.middleRows(static_cast<eigen_size_t>(first), static_cast<eigen_size_t>(count));
+}
+
+
+omnilearn::CsvDataSource::CsvDataSource(std::string const& path, char separator, size_t indexStep):
+_file(std::make_shared<MappedFile const>(path)),
+_separator(separator),
+_indexStep(std::max(static_cast<size_t>(1), indexStep)),
+_size(0),
+_index(),
+_inputLabels(),
+_outputLabels()
+{
+  if(_file->size() == 0)
+    throw Exception("The csv " + path + " is empty.");
+  char const* fileEnd = _file->data() + _file->size();
+  char const* pos = parseLabels(_file->data(), fileEnd, _separator, _inputLabels, _outputLabels);
+
+  //count the features and remember where one line every indexStep begins
+  for(pos = (pos == fileEnd ? fileEnd : pos + 1); pos < fileEnd;)
+  {
+    char const* next = lineEnd(pos, fileEnd);
+    if(!isEmptyLine(pos, next))
+    {
+      if(_size % _indexStep == 0)
+        _index.push_back(pos);
+      _size++;
+    }
+    pos = next + 1;
+  }
+}
+
+
+size_t omnilearn::CsvDataSource::size() const
+{
+  return _size;
+}
+
+
+std::vector<std::string> const& omnilearn::CsvDataSource::inputLabels() const
+{
+  return _inputLabels;
+}
+
+
+std::vector<std::string> const& omnilearn::CsvDataSource::outputLabels() const
+{
+  return _outputLabels;
+}
+
+
+void omnilearn::CsvDataSource::read(size_t first, size_t count, Matrix& inputs, Matrix& outputs) const
+{
+  if(first + count > _size)
+    throw Exception("Features " + std::to_string(first) + " to " + std::to_string(first + count) + " are out of the dataset.");
+  inputs.resize(static_cast<eigen_size_t>(count), static_cast<eigen_size_t>(_inputLabels.size()));
+  outputs.resize(static_cast<eigen_size_t>(count), static_cast<eigen_size_t>(_outputLabels.size()));
+  if(count == 0)
+    return;
+
+  char const* fileEnd = _file->data() + _file->size();
+  char const* pos = _index[first / _indexStep];
+  size_t feature = first - first % _indexStep;
+  for(size_t row = 0; row < count && pos < fileEnd;)
+  {
+    char const* next = lineEnd(pos, fileEnd);
+    if(!isEmptyLine(pos, next))
+    {
+      if(feature >= first)
+      {
+        eigen_size_t r = static_cast<eigen_size_t>(row);
+        parseLine(pos, next, _separator, feature + 1, inputs.row(r).data(), inputs.cols(), outputs.row(r).data(), outputs.cols());
+        row++;
+      }
+      feature++;
+    }
+    pos = next + 1;
+  }
+}
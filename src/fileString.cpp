@@ -2,37 +2,31 @@
 
 #include "omnilearn/fileString.hh"
 
+#include <charconv>
+
 
 
 std::string omnilearn::strip(std::string str, char c)
 {
-  while(true)
-  {
-    if(str[0]==c)
-      str.erase(0, 1);
-    else
-      break;
-  }
-  while(true)
-  {
-    if(str[str.size()-1]==c)
-      str.erase(str.size()-1, 1);
-    else
-      break;
-  }
-  return str;
+  size_t first = str.find_first_not_of(c);
+  if(first == std::string::npos)
+    return std::string();
+  return str.substr(first, str.find_last_not_of(c) - first + 1);
 }
 
 
 std::vector<std::string> omnilearn::split(std::string str, char c)
 {
-  std::vector<std::string> vec(std::count(str.begin(), str.end(), c)+1);
-  for(size_t i = 0; i < vec.size(); i++)
+  std::vector<std::string> vec;
+  size_t begin = 0;
+  while(true)
   {
-    vec[i] = str.substr(0, str.find_first_of(c));
-    str.erase(0, str.find_first_of(c)+1);
+    size_t end = str.find(c, begin);
+    vec.push_back(str.substr(begin, end == std::string::npos ? std::string::npos : end - begin));
+    if(end == std::string::npos)
+      break;
+    begin = end + 1;
   }
-  vec[vec.size()-1] = str.substr(0);
   return vec;
 }
 
@@ -40,16 +34,12 @@ std::vector<std::string> omnilearn::split(std::string str, char c)
 std::string omnilearn::removeRepetition(std::string const& str, char c)
 {
   std::string output;
-  size_t pos = 0;
-  while(true)
+  output.reserve(str.size());
+  for(size_t pos = 0; pos < str.size(); pos++)
   {
-    if(pos < str.size()-1 && str[pos] == str[pos+1] && str[pos] == c)
-      ;
-    else if(pos < str.size())
+    //only the last character of a repetition is kept
+    if(str[pos] != c || pos + 1 == str.size() || str[pos+1] != c)
       output += str[pos];
-    else
-      break;
-    pos++;
   }
   return output;
 }
@@ -82,4 +72,70 @@ std::vector<std::string> omnilearn::readCleanLines(std::string path)
     content[i] = removeRepetition(content[i], '\t');
   }
   return content;
-}
\ No newline at end of file
+}
+
+
+//lines of content (views on it), without the trimmed characters at their ends
+std::vector<std::string_view> omnilearn::splitLines(std::string_view content, std::string_view trimmed)
+{
+  std::vector<std::string_view> lines;
+  size_t begin = 0;
+  while(begin <= content.size())
+  {
+    size_t end = std::min(content.find('\n', begin), content.size());
+    std::string_view line = content.substr(begin, end - begin);
+    size_t first = line.find_first_not_of(trimmed);
+    lines.push_back(first == std::string_view::npos ? std::string_view() : line.substr(first, line.find_last_not_of(trimmed) - first + 1));
+    begin = end + 1;
+  }
+  return lines;
+}
+
+
+//numbers separated by any number of spaces, tabs or commas
+std::vector<double> omnilearn::parseNumbers(std::string_view str)
+{
+  std::vector<double> numbers;
+  char const* pos = str.data();
+  char const* end = str.data() + str.size();
+  while(true)
+  {
+    while(pos != end && (*pos == ' ' || *pos == '\t' || *pos == ',' || *pos == '\r'))
+      pos++;
+    if(pos == end)
+      break;
+    double value = 0;
+    std::from_chars_result result = std::from_chars(pos, end, value);
+    if(result.ec != std::errc())
+      throw Exception("Cannot read a number in \"" + std::string(str) + "\".");
+    numbers.push_back(value);
+    pos = result.ptr;
+  }
+  return numbers;
+}
+
+
+double omnilearn::parseNumber(std::string_view str)
+{
+  std::vector<double> numbers = parseNumbers(str);
+  if(numbers.size() != 1)
+    throw Exception("Cannot read a number in \"" + std::string(str) + "\".");
+  return numbers[0];
+}
+
+
+//shortest representation that reads back to the same value
+void omnilearn::appendNumber(std::string& str, double value)
+{
+  char buffer[32];
+  std::to_chars_result result = std::to_chars(buffer, buffer + sizeof(buffer), value);
+  str.append(buffer, result.ptr);
+}
+
+
+std::string omnilearn::toString(double value)
+{
+  std::string str;
+  appendNumber(str, value);
+  return str;
+}
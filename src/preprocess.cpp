@@ -137,4 +137,85 @@ void omnilearn::reduce(Matrix& data, std::pair<Matrix, Vector> const& singular,
       break;
     }
   }
-}
\ No newline at end of file
+}
+
+
+omnilearn::StreamingStats::StreamingStats(size_t cols, bool crossProducts):
+_count(0),
+_mean(Vector::Constant(static_cast<eigen_size_t>(cols), 0)),
+_m2(Vector::Constant(static_cast<eigen_size_t>(cols), 0)),
+_min(Vector::Constant(static_cast<eigen_size_t>(cols), std::numeric_limits<double>::max())),
+_max(Vector::Constant(static_cast<eigen_size_t>(cols), std::numeric_limits<double>::lowest())),
+_crossProducts(crossProducts),
+_xtx(crossProducts ? Matrix::Constant(static_cast<eigen_size_t>(cols), static_cast<eigen_size_t>(cols), 0) : Matrix(0, 0))
+{
+}
+
+
+void omnilearn::StreamingStats::add(Eigen::Ref<Matrix const> data)
+{
+  if(data.rows() == 0)
+    return;
+  if(data.cols() != _mean.size())
+    throw Exception("Chunks given to the streaming statistics must have " + std::to_string(_mean.size()) + " columns.");
+
+  //merge the mean and the squared differences of the chunk with the previous ones (Chan et al.)
+  double n = static_cast<double>(data.rows());
+  Vector chunkMean = data.colwise().mean().transpose();
+  Vector chunkM2 = (data.rowwise() - chunkMean.transpose()).colwise().squaredNorm().transpose();
+  Vector delta = chunkMean - _mean;
+  double total = _count + n;
+  _mean += delta * (n / total);
+  _m2 += chunkM2 + delta.cwiseAbs2() * (_count * n / total);
+  _count = total;
+
+  _min = _min.cwiseMin(data.colwise().minCoeff().transpose());
+  _max = _max.cwiseMax(data.colwise().maxCoeff().transpose());
+  if(_crossProducts)
+    _xtx.noalias() += data.transpose() * data;
+}
+
+
+omnilearn::Vector omnilearn::StreamingStats::mean() const
+{
+  return _mean;
+}
+
+
+std::vector<std::pair<double, double>> omnilearn::StreamingStats::minMax() const
+{
+  std::vector<std::pair<double, double>> mM(static_cast<size_t>(_mean.size()), {0, 0});
+  for(eigen_size_t i = 0; i < _mean.size(); i++)
+  {
+    mM[i] = {_min[i], _max[i]};
+    if(std::abs(mM[i].second - mM[i].first) < std::numeric_limits<double>::epsilon())
+      throw Exception("Normalization can't be performed because some values have 0 variance. Try reduction.");
+  }
+  return mM;
+}
+
+
+std::vector<std::pair<double, double>> omnilearn::StreamingStats::meanDev() const
+{
+  std::vector<std::pair<double, double>> meanDev(static_cast<size_t>(_mean.size()), {0, 0});
+  for(eigen_size_t i = 0; i < _mean.size(); i++)
+  {
+    meanDev[i] = {_mean[i], std::sqrt(_m2[i] / (_count - 1))};
+    if(std::abs(meanDev[i].second) < std::numeric_limits<double>::epsilon())
+      throw Exception("Standardization can't be performed because some inputs have 0 variance. Try reduction.");
+  }
+  return meanDev;
+}
+
+
+//USE THIS FUNCTION ONLY IF DATA ARE MEAN CENTERED
+std::pair<omnilearn::Matrix, omnilearn::Vector> omnilearn::StreamingStats::decorrelation() const
+{
+  if(!_crossProducts)
+    throw Exception("Cross products must be accumulated to compute the decorrelation.");
+  Matrix cov = _xtx / (_count - 1);
+
+  //in U, eigen vectors are columns
+  Eigen::BDCSVD<Matrix> svd(cov, Eigen::ComputeFullU);
+  return {svd.matrixU(), svd.singularValues()};
+}